@@ -0,0 +1,215 @@
+/*
+* Benchmark of ttf-parser on synthetic fonts
+* Every stage runs for at least --min-time seconds, results are printed as a table or as JSON (--json) for tracking across versions
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <functional>
+
+#define TTF_FONT_PARSER_IMPLEMENTATION
+#include "../src/ttfParser.h"
+#include "syntheticFont.h"
+
+#ifndef TTF_FONT_PARSER_REVISION
+#define TTF_FONT_PARSER_REVISION "unknown"
+#endif
+
+struct BenchmarkResult {
+	const char* name;
+	uint64_t iterations;
+	double seconds;
+	double items; //per iteration
+	double bytes; //per iteration
+	const char* unit;
+};
+
+//Repeats run until min_time has passed, run returns a value that is accumulated so the work is not optimized away
+static BenchmarkResult measure(const char* name, const char* unit, double items, double bytes, double min_time, const std::function<uint64_t()>& run) {
+	static volatile uint64_t sink = 0;
+	run(); //warm up
+	uint64_t iterations = 0;
+	uint64_t accumulated = 0;
+	const auto start = std::chrono::steady_clock::now();
+	double seconds = 0.0;
+	do {
+		accumulated += run();
+		iterations++;
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (seconds < min_time);
+	sink = sink + accumulated;
+	return { name, iterations, seconds, items, bytes, unit };
+}
+
+static void print_usage() {
+	printf("Usage: ttfParserBenchmark [options]\n"
+		"  --glyphs N            glyph count (2000)\n"
+		"  --contours N          contours per simple glyph (3)\n"
+		"  --points N            points per contour (12)\n"
+		"  --composite-ratio F   share of composite glyphs (0.1)\n"
+		"  --cmap-ranges N       codepoint ranges (8)\n"
+		"  --cmap-format N       4 or 12 (4)\n"
+		"  --kern-pairs N        kern table pairs (5000)\n"
+		"  --seed N              generator seed (1)\n"
+		"  --min-time S          seconds per stage (0.5)\n"
+		"  --font FILE           benchmark a font file instead of a synthetic font\n"
+		"  --save FILE           write the synthetic font\n"
+		"  --json                machine readable output\n");
+}
+
+int main(int argc, char** argv) {
+	SyntheticFont::Options options;
+	double min_time = 0.5;
+	bool json = false;
+	const char* font_file = nullptr;
+	const char* save_file = nullptr;
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (!strcmp(arg, "--json")) {
+			json = true;
+			continue;
+		}
+		if (!strcmp(arg, "--help") || !value) {
+			print_usage();
+			return strcmp(arg, "--help") ? 1 : 0;
+		}
+		i++;
+		if (!strcmp(arg, "--glyphs")) options.num_glyphs = uint32_t(atoi(value));
+		else if (!strcmp(arg, "--contours")) options.contours_per_glyph = uint32_t(atoi(value));
+		else if (!strcmp(arg, "--points")) options.points_per_contour = uint32_t(atoi(value));
+		else if (!strcmp(arg, "--composite-ratio")) options.composite_ratio = float(atof(value));
+		else if (!strcmp(arg, "--cmap-ranges")) options.cmap_ranges = uint32_t(atoi(value));
+		else if (!strcmp(arg, "--cmap-format")) options.cmap_format = uint32_t(atoi(value));
+		else if (!strcmp(arg, "--kern-pairs")) options.kern_pairs = uint32_t(atoi(value));
+		else if (!strcmp(arg, "--seed")) options.seed = uint32_t(atoi(value));
+		else if (!strcmp(arg, "--min-time")) min_time = atof(value);
+		else if (!strcmp(arg, "--font")) font_file = value;
+		else if (!strcmp(arg, "--save")) save_file = value;
+		else {
+			print_usage();
+			return 1;
+		}
+	}
+
+	//Font under test, the synthetic one is also written to a file for the load stage
+	std::vector<char> font;
+	std::vector<uint32_t> characters;
+	uint32_t num_composites = 0;
+	std::string file_name;
+	if (font_file) {
+		TTFFontParser::FontFileBuffer file;
+		if (file.open(font_file)) {
+			fprintf(stderr, "Unable to read %s\n", font_file);
+			return 1;
+		}
+		font.assign(file.data, file.data + file.length);
+		file_name = font_file;
+	}
+	else {
+		SyntheticFont::Font synthetic = SyntheticFont::generate(options);
+		font = std::move(synthetic.data);
+		characters = std::move(synthetic.characters);
+		num_composites = synthetic.num_composites;
+		file_name = save_file ? save_file : "ttfParserBenchmark.ttf";
+		FILE* file = fopen(file_name.c_str(), "wb");
+		if (!file || fwrite(font.data(), 1, font.size(), file) != font.size()) {
+			fprintf(stderr, "Unable to write %s\n", file_name.c_str());
+			return 1;
+		}
+		fclose(file);
+	}
+
+	TTFFontParser::FontData reference;
+	int8_t error = TTFFontParser::parse_data(font.data(), font.size(), &reference);
+	if (error) {
+		fprintf(stderr, "Font does not parse: error %d\n", error);
+		return 1;
+	}
+	if (characters.empty()) {
+		for (const auto& range : reference.character_map.ranges) {
+			for (uint32_t c = range.start; c <= range.end && characters.size() < 65536; c++)
+				characters.push_back(c);
+		}
+	}
+	TTFFontParser::FontFace reference_face;
+	reference_face.open(font.data(), font.size());
+	const uint32_t num_glyphs = reference_face.max_profile.numGlyphs;
+	std::vector<uint16_t> glyph_run;
+	for (uint32_t c : characters)
+		glyph_run.push_back(reference.character_map.get_glyph_index(c));
+	const double font_bytes = double(font.size());
+
+	std::vector<BenchmarkResult> results;
+	results.push_back(measure("file_load", "files", 1, font_bytes, min_time, [&file_name]() -> uint64_t {
+		TTFFontParser::FontFileBuffer file;
+		if (file.open(file_name.c_str()))
+			return 0;
+		return TTFFontParser::table_checksum(file.data, uint32_t(file.length)); //touches every page of a mapping
+	}));
+	results.push_back(measure("validate", "fonts", 1, font_bytes, min_time, [&font]() -> uint64_t {
+		return uint64_t(TTFFontParser::validate_data(font.data(), font.size()));
+	}));
+	results.push_back(measure("face_open", "fonts", 1, 0, min_time, [&font]() -> uint64_t {
+		TTFFontParser::FontFace face;
+		return uint64_t(face.open(font.data()));
+	}));
+	results.push_back(measure("full_parse", "fonts", 1, font_bytes, min_time, [&font]() -> uint64_t {
+		TTFFontParser::FontData font_data;
+		TTFFontParser::parse_data(font.data(), font.size(), &font_data);
+		return font_data.glyphs.size();
+	}));
+	results.push_back(measure("glyph_decode", "glyphs", num_glyphs, font_bytes, min_time, [&font, num_glyphs]() -> uint64_t {
+		TTFFontParser::FontFace face;
+		face.open(font.data());
+		uint64_t num_paths = 0;
+		for (uint32_t i = 0; i < num_glyphs; i++)
+			num_paths += face.get_glyph_by_index(uint16_t(i))->path_list.size();
+		return num_paths;
+	}));
+	results.push_back(measure("cmap_lookup", "lookups", double(characters.size()), 0, min_time, [&reference, &characters]() -> uint64_t {
+		uint64_t sum = 0;
+		for (uint32_t c : characters)
+			sum += reference.character_map.get_glyph_index(c);
+		return sum;
+	}));
+	results.push_back(measure("kerning_lookup", "pairs", double(glyph_run.size() * 2), 0, min_time, [&reference, &glyph_run]() -> uint64_t {
+		//Every glyph against its neighbour and against a kerned partner of the synthetic table (glyph 1)
+		int64_t sum = 0;
+		for (size_t i = 0; i < glyph_run.size(); i++) {
+			sum += reference.kearning_table.get_kerning(glyph_run[i], glyph_run[(i + 1) % glyph_run.size()]);
+			sum += reference.kearning_table.get_kerning(glyph_run[i], 1);
+		}
+		return uint64_t(sum);
+	}));
+
+	if (json) {
+		printf("{\n  \"revision\": \"%s\",\n", TTF_FONT_PARSER_REVISION);
+		printf("  \"font\": { \"source\": \"%s\", \"bytes\": %zu, \"glyphs\": %u, \"composites\": %u, \"characters\": %zu, \"kern_pairs\": %u,"
+			" \"contours_per_glyph\": %u, \"points_per_contour\": %u, \"cmap_ranges\": %u, \"cmap_format\": %u, \"seed\": %u },\n",
+			font_file ? font_file : "synthetic", font.size(), num_glyphs, num_composites, characters.size(), font_file ? 0 : options.kern_pairs,
+			options.contours_per_glyph, options.points_per_contour, options.cmap_ranges, options.cmap_format, options.seed);
+		printf("  \"results\": [\n");
+		for (size_t i = 0; i < results.size(); i++) {
+			const BenchmarkResult& result = results[i];
+			const double per_iteration = result.seconds / double(result.iterations);
+			printf("    { \"name\": \"%s\", \"iterations\": %llu, \"ns_per_iteration\": %.1f, \"items_per_second\": %.1f, \"unit\": \"%s\", \"bytes_per_second\": %.1f }%s\n",
+				result.name, (unsigned long long)result.iterations, per_iteration * 1e9, result.items / per_iteration, result.unit,
+				result.bytes / per_iteration, i + 1 < results.size() ? "," : "");
+		}
+		printf("  ]\n}\n");
+	}
+	else {
+		printf("font %s: %zu bytes, %u glyphs (%u composite), %zu characters\n", font_file ? font_file : "synthetic", font.size(), num_glyphs, num_composites, characters.size());
+		printf("%-16s %12s %16s %20s %12s\n", "stage", "iterations", "time/iteration", "throughput", "MB/s");
+		for (const BenchmarkResult& result : results) {
+			const double per_iteration = result.seconds / double(result.iterations);
+			char throughput[64];
+			snprintf(throughput, sizeof(throughput), "%.3g %s/s", result.items / per_iteration, result.unit);
+			printf("%-16s %12llu %13.1f us %20s %12.1f\n", result.name, (unsigned long long)result.iterations, per_iteration * 1e6, throughput,
+				result.bytes / per_iteration / 1e6);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,345 @@
+/*
+* Generator of synthetic TrueType fonts for the benchmarks
+* The fonts are valid for the parser (and pass verify_checksums) but are not meant to be rendered
+*/
+
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace SyntheticFont {
+	struct Options {
+		uint32_t num_glyphs = 2000; //including .notdef, at most 65535
+		uint32_t contours_per_glyph = 3;
+		uint32_t points_per_contour = 12; //every second point is off curve
+		float composite_ratio = 0.1f; //share of the glyphs made of two components
+		uint32_t cmap_ranges = 8; //disjoint codepoint ranges the glyphs are spread over
+		uint32_t cmap_format = 4; //4 for a BMP font, 12 for ranges above the BMP
+		uint32_t kern_pairs = 5000; //format 0 pairs in the kern table, at most 65535
+		uint32_t seed = 1;
+		//Glyphs 1 to composite_chain - 1 are composites of the next glyph, for testing the nesting limit
+		uint32_t composite_chain = 0;
+	};
+
+	//Codepoints of the glyphs, glyph i + 1 maps to characters[i]
+	struct Font {
+		std::vector<char> data;
+		std::vector<uint32_t> characters;
+		uint32_t num_composites = 0;
+	};
+
+	struct Writer {
+		std::vector<char> bytes;
+
+		void u8(uint8_t value) { bytes.push_back(char(value)); }
+		void u16(uint16_t value) { u8(uint8_t(value >> 8)); u8(uint8_t(value)); }
+		void u32(uint32_t value) { u16(uint16_t(value >> 16)); u16(uint16_t(value)); }
+		void u64(uint64_t value) { u32(uint32_t(value >> 32)); u32(uint32_t(value)); }
+		void pad4() { while (bytes.size() & 3) u8(0); }
+		size_t size() const { return bytes.size(); }
+		void put_u32(size_t offset, uint32_t value) {
+			for (int i = 0; i < 4; i++)
+				bytes[offset + i] = char(value >> (24 - i * 8));
+		}
+	};
+
+	inline uint32_t checksum(const char* data, size_t length) {
+		uint32_t sum = 0;
+		for (size_t i = 0; i < length; i += 4) {
+			uint32_t word = 0;
+			for (size_t j = 0; j < 4; j++)
+				word = (word << 8) | (i + j < length ? uint8_t(data[i + j]) : 0);
+			sum += word;
+		}
+		return sum;
+	}
+
+	//xorshift32, the same seed always gives the same font
+	struct Random {
+		uint32_t state;
+		explicit Random(uint32_t seed) : state(seed ? seed : 1) {}
+		uint32_t next() {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return state;
+		}
+		int32_t range(int32_t low, int32_t high) { return low + int32_t(next() % uint32_t(high - low + 1)); }
+	};
+
+	inline void write_simple_glyph(Writer& glyf, Random& random, uint32_t num_contours, uint32_t points_per_contour) {
+		const uint32_t num_points = num_contours * points_per_contour;
+		std::vector<int16_t> x(num_points), y(num_points);
+		for (uint32_t i = 0; i < num_points; i++) {
+			//Mostly small steps so both delta encodings are used
+			x[i] = int16_t(random.range(0, 1000));
+			y[i] = int16_t(i % 4 ? random.range(-200, 800) : (i ? y[i - 1] + random.range(-100, 100) : 0));
+		}
+		glyf.u16(uint16_t(num_contours));
+		glyf.u16(0); glyf.u16(uint16_t(-200)); glyf.u16(1000); glyf.u16(800); //bounding box
+		for (uint32_t c = 0; c < num_contours; c++)
+			glyf.u16(uint16_t((c + 1) * points_per_contour - 1));
+		glyf.u16(0); //instructions
+		int16_t last_x = 0, last_y = 0;
+		std::vector<uint8_t> flags(num_points);
+		for (uint32_t i = 0; i < num_points; i++) {
+			const int32_t dx = x[i] - last_x, dy = y[i] - last_y;
+			uint8_t flag = (i % 2 == 0) ? 0x01 : 0x00; //on curve
+			if (dx == 0) flag |= 0x10;
+			else if (dx > -256 && dx < 256) flag |= 0x02 | (dx > 0 ? 0x10 : 0);
+			if (dy == 0) flag |= 0x20;
+			else if (dy > -256 && dy < 256) flag |= 0x04 | (dy > 0 ? 0x20 : 0);
+			flags[i] = flag;
+			last_x = x[i];
+			last_y = y[i];
+		}
+		for (uint8_t flag : flags)
+			glyf.u8(flag);
+		last_x = 0;
+		for (uint32_t i = 0; i < num_points; i++) {
+			const int32_t dx = x[i] - last_x;
+			if (flags[i] & 0x02) glyf.u8(uint8_t(dx < 0 ? -dx : dx));
+			else if (!(flags[i] & 0x10)) glyf.u16(uint16_t(int16_t(dx)));
+			last_x = x[i];
+		}
+		last_y = 0;
+		for (uint32_t i = 0; i < num_points; i++) {
+			const int32_t dy = y[i] - last_y;
+			if (flags[i] & 0x04) glyf.u8(uint8_t(dy < 0 ? -dy : dy));
+			else if (!(flags[i] & 0x20)) glyf.u16(uint16_t(int16_t(dy)));
+			last_y = y[i];
+		}
+	}
+
+	//Two components, the second one scaled. Without a second component the first one is the only one
+	inline void write_composite_glyph(Writer& glyf, uint16_t first_component, uint16_t second_component, bool single_component = false) {
+		glyf.u16(uint16_t(-1));
+		glyf.u16(0); glyf.u16(uint16_t(-200)); glyf.u16(1600); glyf.u16(800);
+		glyf.u16(0x0001 | 0x0002 | (single_component ? 0 : 0x0020)); //ARG_1_AND_2_ARE_WORDS, ARGS_ARE_XY_VALUES, MORE_COMPONENTS
+		glyf.u16(first_component);
+		glyf.u16(0); glyf.u16(0);
+		if (single_component)
+			return;
+		glyf.u16(0x0002 | 0x0008); //ARGS_ARE_XY_VALUES, WE_HAVE_A_SCALE
+		glyf.u16(second_component);
+		glyf.u8(100); glyf.u8(50);
+		glyf.u16(0x2000); //0.5 in F2Dot14
+	}
+
+	inline void write_cmap(Writer& cmap, const std::vector<uint32_t>& characters, uint32_t format) {
+		//Runs of consecutive codepoints that also have consecutive glyph indices
+		struct Run { uint32_t first_character; uint32_t last_character; uint32_t first_glyph; };
+		std::vector<Run> runs;
+		for (uint32_t i = 0; i < characters.size(); i++) {
+			if (!runs.empty() && runs.back().last_character + 1 == characters[i])
+				runs.back().last_character++;
+			else
+				runs.push_back({ characters[i], characters[i], i + 1 });
+		}
+		cmap.u16(0);
+		cmap.u16(1);
+		cmap.u16(3);
+		cmap.u16(format == 12 ? 10 : 1);
+		cmap.u32(12);
+		if (format == 12) {
+			cmap.u16(12); cmap.u16(0);
+			cmap.u32(uint32_t(16 + runs.size() * 12));
+			cmap.u32(0);
+			cmap.u32(uint32_t(runs.size()));
+			for (const Run& run : runs) {
+				cmap.u32(run.first_character);
+				cmap.u32(run.last_character);
+				cmap.u32(run.first_glyph);
+			}
+			return;
+		}
+		const uint32_t num_segments = uint32_t(runs.size()) + 1;
+		uint32_t entry_selector = 0;
+		while ((2u << entry_selector) <= num_segments)
+			entry_selector++;
+		const uint32_t search_range = 2u << entry_selector;
+		cmap.u16(4);
+		cmap.u16(uint16_t(16 + num_segments * 8));
+		cmap.u16(0);
+		cmap.u16(uint16_t(num_segments * 2));
+		cmap.u16(uint16_t(search_range));
+		cmap.u16(uint16_t(entry_selector));
+		cmap.u16(uint16_t(num_segments * 2 - search_range));
+		for (const Run& run : runs)
+			cmap.u16(uint16_t(run.last_character));
+		cmap.u16(0xFFFF);
+		cmap.u16(0);
+		for (const Run& run : runs)
+			cmap.u16(uint16_t(run.first_character));
+		cmap.u16(0xFFFF);
+		for (const Run& run : runs)
+			cmap.u16(uint16_t(run.first_glyph - run.first_character));
+		cmap.u16(1);
+		for (uint32_t i = 0; i < num_segments; i++)
+			cmap.u16(0);
+	}
+
+	inline void write_name(Writer& name) {
+		const char* names[] = { "Synthetic", "Regular", "Synthetic Regular", "Synthetic-Regular" };
+		const uint16_t name_ids[] = { 1, 2, 4, 6 };
+		name.u16(0);
+		name.u16(4);
+		name.u16(6 + 4 * 12);
+		uint16_t string_offset = 0;
+		for (int i = 0; i < 4; i++) {
+			const uint16_t length = uint16_t(strlen(names[i]) * 2);
+			name.u16(3); name.u16(1); name.u16(0x409); name.u16(name_ids[i]);
+			name.u16(length); name.u16(string_offset);
+			string_offset = uint16_t(string_offset + length);
+		}
+		for (int i = 0; i < 4; i++) {
+			for (const char* c = names[i]; *c; c++)
+				name.u16(uint16_t(*c));
+		}
+	}
+
+	/*
+	* Tables are written in the recommended order with long loca offsets, checksums and checkSumAdjustment are filled in last
+	*/
+	inline Font generate(const Options& options) {
+		Font font;
+		Random random(options.seed);
+		const uint32_t num_glyphs = std::min<uint32_t>(std::max<uint32_t>(options.num_glyphs, 2), 65535);
+		const uint32_t num_mapped = num_glyphs - 1;
+
+		//Characters, the ranges are separated by gaps so cmap has one segment or group per range
+		const uint32_t num_ranges = std::max<uint32_t>(1, std::min(options.cmap_ranges, num_mapped));
+		const uint32_t per_range = (num_mapped + num_ranges - 1) / num_ranges;
+		uint32_t format = options.cmap_format == 12 ? 12 : 4;
+		const uint32_t range_stride = per_range + 64;
+		const uint32_t first_character = format == 12 ? 0x10000 : 0x20;
+		if (format == 4 && first_character + uint64_t(num_ranges) * range_stride >= 0xFFFF)
+			format = 12;
+		for (uint32_t i = 0; i < num_mapped; i++)
+			font.characters.push_back(first_character + (i / per_range) * range_stride + i % per_range);
+
+		Writer glyf, loca, hmtx;
+		uint32_t max_points = 0, max_contours = 0;
+		std::vector<uint32_t> simple_glyphs;
+		for (uint32_t i = 0; i < num_glyphs; i++) {
+			loca.u32(uint32_t(glyf.size()));
+			const bool composite = i > 2 && simple_glyphs.size() >= 2 && float(random.next() % 10000) < options.composite_ratio * 10000.f;
+			if (i >= 1 && i + 1 < std::min(options.composite_chain, num_glyphs)) {
+				write_composite_glyph(glyf, uint16_t(i + 1), 0, true);
+				font.num_composites++;
+			}
+			else if (composite) {
+				write_composite_glyph(glyf, uint16_t(simple_glyphs[random.next() % simple_glyphs.size()]),
+					uint16_t(simple_glyphs[random.next() % simple_glyphs.size()]));
+				font.num_composites++;
+			}
+			else {
+				const uint32_t num_contours = std::max<uint32_t>(1, options.contours_per_glyph);
+				const uint32_t points_per_contour = std::max<uint32_t>(3, options.points_per_contour);
+				write_simple_glyph(glyf, random, num_contours, points_per_contour);
+				simple_glyphs.push_back(i);
+				max_points = std::max(max_points, num_contours * points_per_contour);
+				max_contours = std::max(max_contours, num_contours);
+			}
+			glyf.pad4();
+			hmtx.u16(uint16_t(random.range(400, 1200)));
+			hmtx.u16(0);
+		}
+		loca.u32(uint32_t(glyf.size()));
+
+		Writer head;
+		head.u32(0x00010000); head.u32(0x00010000);
+		head.u32(0); //checkSumAdjustment
+		head.u32(0x5F0F3CF5);
+		head.u16(0x000B); head.u16(1000);
+		head.u64(0); head.u64(0);
+		head.u16(0); head.u16(uint16_t(-200)); head.u16(1600); head.u16(800);
+		head.u16(0); head.u16(8); head.u16(2);
+		head.u16(1); //long loca
+		head.u16(0);
+
+		Writer hhea;
+		hhea.u32(0x00010000);
+		hhea.u16(800); hhea.u16(uint16_t(-200)); hhea.u16(100);
+		hhea.u16(1200); hhea.u16(0); hhea.u16(0); hhea.u16(1600);
+		hhea.u16(1); hhea.u16(0); hhea.u16(0);
+		for (int i = 0; i < 5; i++)
+			hhea.u16(0);
+		hhea.u16(uint16_t(num_glyphs));
+
+		Writer maxp;
+		maxp.u32(0x00010000);
+		maxp.u16(uint16_t(num_glyphs));
+		maxp.u16(uint16_t(max_points)); maxp.u16(uint16_t(max_contours));
+		maxp.u16(uint16_t(max_points * 2)); maxp.u16(uint16_t(max_contours * 2));
+		maxp.u16(2); maxp.u16(0); maxp.u16(0); maxp.u16(0); maxp.u16(0); maxp.u16(0); maxp.u16(0);
+		maxp.u16(2); maxp.u16(1);
+
+		Writer cmap;
+		write_cmap(cmap, font.characters, format);
+
+		//Pairs sorted by left and right glyph, as binary searching readers expect
+		Writer kern;
+		const uint32_t num_pairs = std::min<uint64_t>(std::min<uint32_t>(options.kern_pairs, 65535), uint64_t(num_mapped) * num_mapped);
+		if (num_pairs) {
+			kern.u16(0); kern.u16(1);
+			kern.u16(0);
+			kern.u16(uint16_t(14 + num_pairs * 6)); //wraps for large tables like in real fonts, readers use nPairs
+			kern.u16(0x0001);
+			kern.u16(uint16_t(num_pairs));
+			kern.u16(0); kern.u16(0); kern.u16(0);
+			const uint32_t pairs_per_left = std::max<uint32_t>(1, std::min(num_mapped, (num_pairs + num_mapped - 1) / num_mapped));
+			for (uint32_t i = 0; i < num_pairs; i++) {
+				kern.u16(uint16_t(1 + i / pairs_per_left));
+				kern.u16(uint16_t(1 + (i % pairs_per_left) * (num_mapped / pairs_per_left)));
+				kern.u16(uint16_t(-int16_t(10 + i % 90)));
+			}
+		}
+
+		Writer name;
+		write_name(name);
+
+		struct Table { const char* tag; Writer* writer; };
+		std::vector<Table> tables = { { "head", &head }, { "hhea", &hhea }, { "maxp", &maxp }, { "hmtx", &hmtx }, { "cmap", &cmap },
+			{ "loca", &loca }, { "glyf", &glyf }, { "name", &name } };
+		if (num_pairs)
+			tables.push_back({ "kern", &kern });
+		std::vector<Table> directory = tables;
+		std::sort(directory.begin(), directory.end(), [](const Table& a, const Table& b) { return memcmp(a.tag, b.tag, 4) < 0; });
+
+		Writer out;
+		const uint16_t num_tables = uint16_t(tables.size());
+		uint16_t entry_selector = 0;
+		while ((2u << entry_selector) <= num_tables)
+			entry_selector++;
+		out.u32(0x00010000);
+		out.u16(num_tables);
+		out.u16(uint16_t(16u << entry_selector));
+		out.u16(entry_selector);
+		out.u16(uint16_t(num_tables * 16 - (16u << entry_selector)));
+		const size_t directory_offset = out.size();
+		for (size_t i = 0; i < directory.size(); i++) {
+			out.u32(0); out.u32(0); out.u32(0); out.u32(0);
+		}
+		size_t head_offset = 0;
+		for (const Table& table : tables) {
+			const size_t offset = out.size();
+			if (!strcmp(table.tag, "head"))
+				head_offset = offset;
+			out.bytes.insert(out.bytes.end(), table.writer->bytes.begin(), table.writer->bytes.end());
+			out.pad4();
+			const size_t index = std::find_if(directory.begin(), directory.end(), [&table](const Table& t) { return t.tag == table.tag; }) - directory.begin();
+			const size_t entry = directory_offset + index * 16;
+			memcpy(out.bytes.data() + entry, table.tag, 4);
+			out.put_u32(entry + 4, checksum(table.writer->bytes.data(), table.writer->size()));
+			out.put_u32(entry + 8, uint32_t(offset));
+			out.put_u32(entry + 12, uint32_t(table.writer->size()));
+		}
+		out.put_u32(head_offset + 8, 0xB1B0AFBA - checksum(out.bytes.data(), out.size()));
+		font.data = std::move(out.bytes);
+		return font;
+	}
+}
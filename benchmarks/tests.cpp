@@ -0,0 +1,322 @@
+/*
+* Checks of ttf-parser that need no font files, run by ctest
+* Usage: ttfParserTests TEST, every test prints what differs and returns 1 on a failure
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#define TTF_FONT_PARSER_IMPLEMENTATION
+#include "../src/ttfParser.h"
+#include "syntheticFont.h"
+
+//Straightforward decoder of the flag and coordinate arrays, returns the number of bytes read
+static size_t reference_decode(const char* src, uint16_t num_points, std::vector<uint8_t>& flags, std::vector<int16_t>& x, std::vector<int16_t>& y) {
+	const char* start = src;
+	flags.assign(num_points, 0);
+	for (uint32_t j = 0; j < num_points;) {
+		const uint8_t flag = uint8_t(*src++);
+		flags[j++] = flag;
+		if (flag & TTFFontParser::REPEAT_FLAG) {
+			for (uint32_t repeat = uint8_t(*src++); repeat && j < num_points; repeat--)
+				flags[j++] = flag;
+		}
+	}
+	for (int axis = 0; axis < 2; axis++) {
+		std::vector<int16_t>& coordinates = axis ? y : x;
+		const uint8_t short_bit = axis ? TTFFontParser::Y_SHORT_VECTOR : TTFFontParser::X_SHORT_VECTOR;
+		const uint8_t same_bit = axis ? TTFFontParser::Y_IS_SAME_OR_POSITIVE_Y_SHORT_VECTOR : TTFFontParser::X_IS_SAME_OR_POSITIVE_X_SHORT_VECTOR;
+		coordinates.assign(num_points, 0);
+		int32_t coordinate = 0;
+		for (uint32_t j = 0; j < num_points; j++) {
+			if (flags[j] & short_bit) {
+				const int32_t delta = uint8_t(*src++);
+				coordinate += (flags[j] & same_bit) ? delta : -delta;
+			}
+			else if (!(flags[j] & same_bit)) {
+				coordinate += int16_t(uint16_t(uint8_t(src[0]) << 8 | uint8_t(src[1])));
+				src += 2;
+			}
+			coordinates[j] = int16_t(coordinate);
+		}
+	}
+	return size_t(src - start);
+}
+
+/*
+* Random point data decoded by decode_glyph_flags / decode_glyph_coordinates and by reference_decode. The library is built
+* scalar in one test and with SSE4.1 in another, the input ends exactly where the point data ends so wide loads past it show up
+*/
+static int test_decode() {
+	SyntheticFont::Random random(12);
+	uint32_t failures = 0;
+	std::vector<uint8_t> expected_flags, flags;
+	std::vector<int16_t> expected_x, expected_y, x, y;
+	for (uint32_t iteration = 0; iteration < 100000; iteration++) {
+		const uint16_t num_points = uint16_t(random.range(1, iteration % 16 ? 64 : 2000));
+		//Mostly random bytes, some runs with fewer repeat flags or only short vectors so the vector loops get long stretches
+		std::vector<char> bytes(size_t(num_points) * 5 + 2);
+		const uint32_t mode = iteration % 4;
+		for (char& byte : bytes) {
+			uint8_t value = uint8_t(random.next() >> 24);
+			if (mode == 1 && random.next() % 8)
+				value &= uint8_t(~TTFFontParser::REPEAT_FLAG);
+			else if (mode == 2)
+				value = uint8_t((value & ~TTFFontParser::REPEAT_FLAG) | TTFFontParser::X_SHORT_VECTOR | TTFFontParser::Y_SHORT_VECTOR);
+			byte = char(value);
+		}
+		const size_t length = reference_decode(bytes.data(), num_points, expected_flags, expected_x, expected_y);
+		const std::vector<char> data(bytes.begin(), bytes.begin() + length);
+		const char* end = data.data() + data.size();
+
+		flags.assign(num_points, 0);
+		x.assign(num_points, 0);
+		y.assign(num_points, 0);
+		const char* src = TTFFontParser::decode_glyph_flags(data.data(), end, flags.data(), num_points);
+		src = TTFFontParser::decode_glyph_coordinates(src, end, flags.data(), num_points, TTFFontParser::X_SHORT_VECTOR,
+			TTFFontParser::X_IS_SAME_OR_POSITIVE_X_SHORT_VECTOR, x.data());
+		src = TTFFontParser::decode_glyph_coordinates(src, end, flags.data(), num_points, TTFFontParser::Y_SHORT_VECTOR,
+			TTFFontParser::Y_IS_SAME_OR_POSITIVE_Y_SHORT_VECTOR, y.data());
+		if (src != end || flags != expected_flags || x != expected_x || y != expected_y) {
+			if (failures++ < 5)
+				printf("decode: iteration %u with %u points differs (read %td of %zu bytes, flags %d, x %d, y %d)\n", iteration, num_points,
+					src - data.data(), length, flags != expected_flags, x != expected_x, y != expected_y);
+		}
+	}
+#ifdef TTF_FONT_PARSER_SSE4
+	const char* path = "SSE4.1";
+#else
+	const char* path = "scalar";
+#endif
+	printf("decode (%s): %u failures\n", path, failures);
+	return failures ? 1 : 0;
+}
+
+static bool same_curves(const std::vector<TTFFontParser::PathRange>& a_ranges, const std::vector<TTFFontParser::Curve>& a_curves,
+	const std::vector<TTFFontParser::PathRange>& b_ranges, const std::vector<TTFFontParser::Curve>& b_curves) {
+	if (a_ranges.size() != b_ranges.size() || a_curves.size() != b_curves.size())
+		return false;
+	for (size_t i = 0; i < a_ranges.size(); i++) {
+		if (a_ranges[i].num_curves != b_ranges[i].num_curves)
+			return false;
+	}
+	//field by field, Curve has padding
+	for (size_t i = 0; i < a_curves.size(); i++) {
+		const TTFFontParser::Curve& a = a_curves[i];
+		const TTFFontParser::Curve& b = b_curves[i];
+		if (a.p0.x != b.p0.x || a.p0.y != b.p0.y || a.p1.x != b.p1.x || a.p1.y != b.p1.y || a.c.x != b.c.x || a.c.y != b.c.y || a.is_curve != b.is_curve)
+			return false;
+	}
+	return true;
+}
+
+static bool same_metrics(const TTFFontParser::Glyph& a, const TTFFontParser::Glyph& b) {
+	return a.character == b.character && a.glyph_index == b.glyph_index && a.num_contours == b.num_contours && a.advance_width == b.advance_width &&
+		a.left_side_bearing == b.left_side_bearing && !memcmp(a.bounding_box, b.bounding_box, sizeof(a.bounding_box));
+}
+
+//Compares the glyphs of two parses of a font by character, the outlines with components expanded. Returns the number of differences
+static uint32_t compare_fonts(const char* test, const TTFFontParser::FontData& a, const TTFFontParser::FontData& b) {
+	uint32_t differences = 0;
+	if (a.glyphs.size() != b.glyphs.size()) {
+		printf("%s: %zu and %zu glyphs\n", test, a.glyphs.size(), b.glyphs.size());
+		return 1;
+	}
+	std::vector<TTFFontParser::PathRange> a_ranges, b_ranges;
+	std::vector<TTFFontParser::Curve> a_curves, b_curves;
+	for (const auto& a_glyph : a.glyphs) {
+		const auto b_glyph = b.glyphs.find(a_glyph.first);
+		a_ranges.clear();
+		a_curves.clear();
+		b_ranges.clear();
+		b_curves.clear();
+		if (b_glyph != b.glyphs.end()) {
+			TTFFontParser::expand_glyph(a, a_glyph.second, a_ranges, a_curves);
+			TTFFontParser::expand_glyph(b, b_glyph->second, b_ranges, b_curves);
+		}
+		if (b_glyph == b.glyphs.end() || !same_metrics(a_glyph.second, b_glyph->second) || !same_curves(a_ranges, a_curves, b_ranges, b_curves)) {
+			if (differences++ < 5)
+				printf("%s: glyph of character %u differs\n", test, a_glyph.first);
+		}
+	}
+	return differences;
+}
+
+//Parallel decoding in parse_data has to give the glyphs of a sequential parse, with path lists and with flat geometry
+static int test_parallel_parse() {
+	SyntheticFont::Options font_options;
+	font_options.num_glyphs = 1500;
+	font_options.composite_ratio = 0.3f;
+	const SyntheticFont::Font font = SyntheticFont::generate(font_options);
+	uint32_t differences = 0;
+	for (int flat = 0; flat < 2; flat++) {
+		TTFFontParser::ParseOptions options;
+		options.flat_geometry = flat != 0;
+		TTFFontParser::FontData sequential;
+		int8_t error = TTFFontParser::parse_data(font.data.data(), font.data.size(), &sequential, options);
+		for (uint32_t num_threads : { 2u, 4u, 7u }) {
+			options.num_threads = num_threads;
+			TTFFontParser::FontData parallel;
+			error |= TTFFontParser::parse_data(font.data.data(), font.data.size(), &parallel, options);
+			differences += compare_fonts("parallel_parse", sequential, parallel);
+		}
+		if (error) {
+			printf("parallel_parse: error %d\n", error);
+			return 1;
+		}
+	}
+	printf("parallel_parse: %u differences\n", differences);
+	return differences ? 1 : 0;
+}
+
+//A font cache written to memory and to a file has to open and give the glyphs, character map and kerning of the parsed font
+static int test_font_cache() {
+	SyntheticFont::Options font_options;
+	font_options.num_glyphs = 600;
+	font_options.composite_ratio = 0.3f;
+	font_options.cmap_format = 12;
+	font_options.kern_pairs = 3000;
+	const SyntheticFont::Font font = SyntheticFont::generate(font_options);
+	const uint64_t key = TTFFontParser::font_cache_key(font.data.data(), font.data.size());
+	uint32_t differences = 0;
+	for (int flat = 0; flat < 2; flat++) {
+		TTFFontParser::ParseOptions options;
+		options.flat_geometry = flat != 0;
+		TTFFontParser::FontData font_data;
+		if (TTFFontParser::parse_data(font.data.data(), font.data.size(), &font_data, options)) {
+			printf("font_cache: font does not parse\n");
+			return 1;
+		}
+		std::vector<char> blob;
+		TTFFontParser::save_font_cache(font_data, key, blob);
+		const char* file_name = "ttfParserTests.cache";
+		TTFFontParser::FontCache memory_cache, file_cache;
+		const int8_t memory_error = memory_cache.open(blob.data(), blob.size(), key, true);
+		const int8_t save_error = TTFFontParser::save_font_cache_file(file_name, font_data, key);
+		const int8_t file_error = save_error ? save_error : file_cache.open_file(file_name, key, true);
+		const int8_t key_error = TTFFontParser::FontCache().open(blob.data(), blob.size(), key + 1);
+		remove(file_name);
+		if (memory_error || file_error || key_error != -1) {
+			printf("font_cache: open gives %d, from a file %d, with another key %d\n", memory_error, file_error, key_error);
+			return 1;
+		}
+
+		for (const TTFFontParser::FontCache* cache : { &memory_cache, &file_cache }) {
+			const uint16_t num_glyphs = cache->num_glyphs();
+			std::vector<TTFFontParser::PathRange> ranges, cache_ranges;
+			std::vector<TTFFontParser::Curve> curves, cache_curves;
+			for (const auto& glyph : font_data.glyphs) {
+				const TTFFontParser::FontCacheGlyph* cache_glyph = cache->get_glyph_by_index(uint16_t(glyph.second.glyph_index));
+				ranges.clear();
+				curves.clear();
+				cache_ranges.clear();
+				cache_curves.clear();
+				TTFFontParser::expand_glyph(font_data, glyph.second, ranges, curves);
+				if (cache_glyph) {
+					for (uint32_t i = 0; i < cache_glyph->num_paths; i++) {
+						const TTFFontParser::PathRange& path = cache->path_ranges()[cache_glyph->first_path + i];
+						cache_ranges.push_back({ uint32_t(cache_curves.size()), path.num_curves });
+						cache_curves.insert(cache_curves.end(), cache->curves() + path.first_curve, cache->curves() + path.first_curve + path.num_curves);
+					}
+				}
+				if (!cache_glyph || cache_glyph->character != glyph.second.character || cache_glyph->advance_width != glyph.second.advance_width ||
+					cache_glyph->left_side_bearing != glyph.second.left_side_bearing || cache_glyph->num_contours != glyph.second.num_contours ||
+					memcmp(cache_glyph->bounding_box, glyph.second.bounding_box, sizeof(cache_glyph->bounding_box)) ||
+					!same_curves(ranges, curves, cache_ranges, cache_curves)) {
+					if (differences++ < 5)
+						printf("font_cache: glyph of character %u differs\n", glyph.first);
+				}
+			}
+			for (uint32_t character : font.characters)
+				differences += cache->get_glyph_index(character) != font_data.character_map.get_glyph_index(character);
+			for (uint32_t character : { 0u, 0x10FFFFu })
+				differences += cache->get_glyph_index(character) != font_data.character_map.get_glyph_index(character);
+			for (uint32_t left = 0; left < num_glyphs; left++) {
+				differences += cache->get_character(uint16_t(left)) != font_data.character_map.get_character(uint16_t(left));
+				for (uint32_t right = 0; right < num_glyphs; right++)
+					differences += cache->get_kerning(uint16_t(left), uint16_t(right)) != font_data.kearning_table.get_kerning(uint16_t(left), uint16_t(right));
+			}
+		}
+	}
+	printf("font_cache: %u differences\n", differences);
+	return differences ? 1 : 0;
+}
+
+//Expanded instanced composites have to match the copies of a parse without ParseOptions::instance_composites, in FontData and FontFace
+//and as rasterized by GlyphBitmapCache
+static int test_instanced_composites() {
+	SyntheticFont::Options font_options;
+	font_options.num_glyphs = 800;
+	font_options.composite_ratio = 0.4f;
+	const SyntheticFont::Font font = SyntheticFont::generate(font_options);
+	uint32_t differences = 0;
+	TTFFontParser::ParseOptions options;
+	TTFFontParser::FontData copied, instanced;
+	int8_t error = TTFFontParser::parse_data(font.data.data(), font.data.size(), &copied, options);
+	options.instance_composites = true;
+	error |= TTFFontParser::parse_data(font.data.data(), font.data.size(), &instanced, options);
+	TTFFontParser::FontFace copied_face, instanced_face;
+	instanced_face.options.instance_composites = true;
+	error |= copied_face.open(font.data.data(), font.data.size());
+	error |= instanced_face.open(font.data.data(), font.data.size());
+	if (error) {
+		printf("instanced_composites: error %d\n", error);
+		return 1;
+	}
+	differences += compare_fonts("instanced_composites", copied, instanced);
+
+	uint32_t num_composites = 0;
+	TTFFontParser::GlyphBitmapCache copied_bitmaps, instanced_bitmaps, copied_face_bitmaps, instanced_face_bitmaps;
+	std::vector<TTFFontParser::PathRange> copied_ranges, instanced_ranges;
+	std::vector<TTFFontParser::Curve> copied_curves, instanced_curves;
+	for (const auto& glyph : instanced.glyphs) {
+		if (glyph.second.components.empty())
+			continue;
+		num_composites++;
+		const uint16_t glyph_index = uint16_t(glyph.second.glyph_index);
+		copied_ranges.clear();
+		copied_curves.clear();
+		instanced_ranges.clear();
+		instanced_curves.clear();
+		copied_face.expand_glyph(glyph_index, copied_ranges, copied_curves);
+		instanced_face.expand_glyph(glyph_index, instanced_ranges, instanced_curves);
+		if (copied_curves.empty() || !same_curves(copied_ranges, copied_curves, instanced_ranges, instanced_curves)) {
+			if (differences++ < 5)
+				printf("instanced_composites: face glyph %u differs\n", glyph_index);
+		}
+		const TTFFontParser::GlyphBitmapCache::Entry* copied_bitmap = copied_bitmaps.get(copied, glyph.first, 24.f, 0.5f);
+		const TTFFontParser::GlyphBitmapCache::Entry* instanced_bitmap = instanced_bitmaps.get(instanced, glyph.first, 24.f, 0.5f);
+		const TTFFontParser::GlyphBitmapCache::Entry* copied_face_bitmap = copied_face_bitmaps.get(copied_face, glyph_index, 24.f, 0.5f);
+		const TTFFontParser::GlyphBitmapCache::Entry* instanced_face_bitmap = instanced_face_bitmaps.get(instanced_face, glyph_index, 24.f, 0.5f);
+		if (!copied_bitmap || !instanced_bitmap || !copied_face_bitmap || !instanced_face_bitmap || !instanced_bitmap->bitmap.width ||
+			copied_bitmap->bitmap.pixels != instanced_bitmap->bitmap.pixels || copied_face_bitmap->bitmap.pixels != instanced_face_bitmap->bitmap.pixels) {
+			if (differences++ < 5)
+				printf("instanced_composites: bitmap of glyph %u differs\n", glyph_index);
+		}
+	}
+	if (!num_composites) {
+		printf("instanced_composites: the font has no composite glyphs\n");
+		return 1;
+	}
+	printf("instanced_composites: %u composites, %u differences\n", num_composites, differences);
+	return differences ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+	struct Test { const char* name; int (*run)(); };
+	const Test tests[] = {
+		{ "decode", test_decode },
+		{ "parallel_parse", test_parallel_parse },
+		{ "font_cache", test_font_cache },
+		{ "instanced_composites", test_instanced_composites },
+	};
+	for (const Test& test : tests) {
+		if (argc == 2 && !strcmp(argv[1], test.name))
+			return test.run();
+	}
+	printf("Usage: ttfParserTests TEST\n  tests:");
+	for (const Test& test : tests)
+		printf(" %s", test.name);
+	printf("\n");
+	return 1;
+}
@@ -6,7 +6,6 @@
 #include <stdio.h>
 #include <cwchar>
 #include <chrono>
-#include <thread>
 
 #define TTF_FONT_PARSER_IMPLEMENTATION
 #include "../src/ttfParser.h"
@@ -47,12 +46,13 @@ void font_parsed(void* args, void* _font_data, int error) {
 int main() {
 	uint8_t condition_variable = 0;
 
-	TTFFontParser::FontData font_data;
-	int8_t error = TTFFontParser::parse_file(font_path, &font_data, &font_parsed, &condition_variable);
-
-	while (!condition_variable) {
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
-	}
+	//The font is read and parsed on a worker thread while the calling thread keeps going, here it counts 16 ms frames like a UI thread would draw them
+	TTFFontParser::ParseFuture future = TTFFontParser::parse_file_async(font_path);
+	uint32_t frames = 0;
+	while (!future.wait_for(std::chrono::milliseconds(16)))
+		frames++;
+	printf("Font ready after %u frames\n", frames);
+	font_parsed(&condition_variable, future.get(), future.wait());
 
 	getchar();
 
@@ -10,15 +10,48 @@
 #pragma once
 
 #include <stdint.h>
-#include <map>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
+#include <list>
+#include <memory>
+#include <memory_resource>
+#include <algorithm>
+#include <atomic>
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <chrono>
+#define TTF_FONT_PARSER_THREADS
+#endif
+#ifdef _MSC_VER
+#include <stdlib.h>
+#include <intrin.h>
+#endif
+#if !defined(TTF_FONT_PARSER_NO_SIMD) && (defined(__SSE4_1__) || defined(__AVX__))
+#include <immintrin.h>
+#define TTF_FONT_PARSER_SSE4
+#endif
 #ifdef __EMSCRIPTEN__
 #include "emscripten.h"
 #include "emscripten/val.h"
 #define TTFDEBUG_PRINT(...) {}
 #else
 #include <fstream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TTF_FONT_PARSER_MMAP
+#endif
 #ifdef _DEBUG
 #include <stdio.h>
 #define TTFDEBUG_PRINT(...) printf(__VA_ARGS__)
@@ -28,36 +61,126 @@
 #endif
 
 namespace TTFFontParser {
-	typedef void(*TTF_FONT_MEM_CPY)(void*, const char*);
+	//Big endian readers, the host byte order is fixed at compile time so every read is an inlined load
+	inline uint16_t byte_swap(uint16_t value) {
+#if defined(_MSC_VER)
+		return _byteswap_ushort(value);
+#else
+		return __builtin_bswap16(value);
+#endif
+	}
+	inline uint32_t byte_swap(uint32_t value) {
+#if defined(_MSC_VER)
+		return _byteswap_ulong(value);
+#else
+		return __builtin_bswap32(value);
+#endif
+	}
+	inline uint64_t byte_swap(uint64_t value) {
+#if defined(_MSC_VER)
+		return _byteswap_uint64(value);
+#else
+		return __builtin_bswap64(value);
+#endif
+	}
+	inline uint8_t byte_swap(uint8_t value) {
+		return value;
+	}
+	template<size_t SIZE> struct UnsignedOfSize;
+	template<> struct UnsignedOfSize<1> { typedef uint8_t type; };
+	template<> struct UnsignedOfSize<2> { typedef uint16_t type; };
+	template<> struct UnsignedOfSize<4> { typedef uint32_t type; };
+	template<> struct UnsignedOfSize<8> { typedef uint64_t type; };
+
+	template<typename T> inline T read_be(const char* src) {
+		typedef typename UnsignedOfSize<sizeof(T)>::type raw_type;
+		raw_type raw;
+		memcpy(&raw, src, sizeof(T));
+#if !(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+		raw = byte_swap(raw);
+#endif
+		T value;
+		memcpy(&value, &raw, sizeof(T));
+		return value;
+	}
+	template<typename T> inline void get1b(T* dst, const char* src) {
+		*dst = T(uint8_t(*src));
+	}
+	template<typename T> inline void get2b(T* dst, const char* src) {
+		static_assert(sizeof(T) == sizeof(uint16_t), "get2b needs a 2 byte destination");
+		*dst = read_be<T>(src);
+	}
+	template<typename T> inline void get4b(T* dst, const char* src) {
+		static_assert(sizeof(T) == sizeof(uint32_t), "get4b needs a 4 byte destination");
+		*dst = read_be<T>(src);
+	}
+	template<typename T> inline void get8b(T* dst, const char* src) {
+		static_assert(sizeof(T) == sizeof(uint64_t), "get8b needs an 8 byte destination");
+		*dst = read_be<T>(src);
+	}
+
+	//Big endian reads that are checked against the length of a table, for nested offset structures read once at load time
+	struct BoundedReader {
+		const char* data;
+		uint32_t length;
+		bool valid = true; //stays false after the first read outside of the table
+
+		BoundedReader(const char* _data, uint32_t _length) : data(_data), length(_length) {}
+		template<typename T> T read(uint64_t offset) {
+			if (offset + sizeof(T) > length) {
+				valid = false;
+				return T(0);
+			}
+			return read_be<T>(data + offset);
+		}
+		uint16_t u16(uint64_t offset) { return read<uint16_t>(offset); }
+		int16_t s16(uint64_t offset) { return read<int16_t>(offset); }
+		uint32_t u32(uint64_t offset) { return read<uint32_t>(offset); }
+	};
+
+	//Compile time description of a big endian table layout, fields are listed in file order
+	template<auto MEMBER> struct Field;
+	template<typename TABLE, typename T, T TABLE::* MEMBER> struct Field<MEMBER> {
+		static constexpr uint32_t size = sizeof(T);
+		static inline void read(TABLE& table, const char* src) { table.*MEMBER = read_be<T>(src); }
+	};
+	template<uint32_t BYTES> struct Skip {
+		static constexpr uint32_t size = BYTES;
+		template<typename TABLE> static inline void read(TABLE&, const char*) {}
+	};
+	template<typename... FIELDS> struct TableLayout {
+		static constexpr uint32_t size = (FIELDS::size + ...);
+
+		template<typename TABLE> static inline uint32_t parse(TABLE& table, const char* data, uint32_t offset) {
+			const char* src = data + offset;
+			((FIELDS::read(table, src), src += FIELDS::size), ...);
+			return offset + size;
+		}
+	};
+
 #ifdef __cplusplus
 	extern "C" {
 #endif
-		extern TTF_FONT_MEM_CPY get2b;
-		extern TTF_FONT_MEM_CPY get4b;
-		extern TTF_FONT_MEM_CPY get8b;
-		extern uint32_t little_endian_test;
-		extern bool endian_tested;
-
-		extern void get4b_be(void* dst, const char* src);
-		extern void get4b_le(void* dst, const char* src);
-		extern void get8b_be(void* dst, const char* src);
-		extern void get8b_le(void* dst, const char* src);
-		extern void get2b_be(void* dst, const char* src);
-		extern void get2b_le(void* dst, const char* src);
-		extern void get1b(void* dst, const char* src);
 		extern float to_2_14_float(int16_t value);
 #ifdef __cplusplus
 	}
 #endif
-		
-	struct Flags {
-		bool xDual;
-		bool yDual;
-		bool xShort;
-		bool yShort;
-		bool repeat;
-		bool offCurve;
+
+	enum SIMPLE_GLYPH_FLAGS {
+		ON_CURVE_POINT = 0x01,
+		X_SHORT_VECTOR = 0x02,
+		Y_SHORT_VECTOR = 0x04,
+		REPEAT_FLAG = 0x08,
+		X_IS_SAME_OR_POSITIVE_X_SHORT_VECTOR = 0x10,
+		Y_IS_SAME_OR_POSITIVE_Y_SHORT_VECTOR = 0x20
 	};
+	//Point decoding of simple glyphs, vectorized with SSE4.1 when the build targets it (define TTF_FONT_PARSER_NO_SIMD to always use the scalar code)
+	//src_end only limits the wide loads, the point data itself is not bounds checked
+	//Expands the repeat encoded flags to one byte per point, returns the end of the flag data
+	const char* decode_glyph_flags(const char* src, const char* src_end, uint8_t* flags, uint16_t num_points);
+	//Reads the 0, 1 or 2 byte deltas of one axis (short_bit and same_bit select x or y) and accumulates them, returns the end of the coordinate data
+	const char* decode_glyph_coordinates(const char* src, const char* src_end, const uint8_t* flags, uint16_t num_points, uint8_t short_bit, uint8_t same_bit, int16_t* coordinates);
+
 	enum COMPOUND_GLYPH_FLAGS {
 		ARG_1_AND_2_ARE_WORDS = 0x0001,
 		ARGS_ARE_XY_VALUES = 0x0002,
@@ -80,32 +203,69 @@ namespace TTFFontParser {
 		uint16_t entrySelector;
 		uint16_t rangeShift;
 
+		typedef TableLayout<Field<&TTFHeader::version>, Field<&TTFHeader::numTables>,
+			Skip<sizeof(uint16_t) * 3>> Layout; //searchRange, entrySelector and rangeShift are not needed
+
 		uint32_t parse(const char* data, uint32_t offset) {
-			get4b(&version, data + offset); offset += sizeof(uint32_t);
-			get2b(&numTables, data + offset); offset += sizeof(uint16_t);
-			/*get2b(&searchRange, data + offset); offset += sizeof(uint16_t);
-			get2b(&entrySelector, data + offset); offset += sizeof(uint16_t);
-			get2b(&rangeShift, data + offset); offset += sizeof(uint16_t);*/
-			offset += sizeof(uint16_t) * 3;
-			return offset;
+			return Layout::parse(*this, data, offset);
+		}
+	};
+	//TrueType collection (ttcf) header, followed by numFonts offsets of table directories
+	struct CollectionHeader
+	{
+		uint32_t tag;
+		uint16_t majorVersion;
+		uint16_t minorVersion;
+		uint32_t numFonts;
+
+		typedef TableLayout<Field<&CollectionHeader::tag>, Field<&CollectionHeader::majorVersion>, Field<&CollectionHeader::minorVersion>,
+			Field<&CollectionHeader::numFonts>> Layout;
+
+		uint32_t parse(const char* data, uint32_t offset) {
+			return Layout::parse(*this, data, offset);
 		}
 	};
+	//Table tags are compared as the big endian uint32 of their 4 characters
+	constexpr uint32_t make_tag(char a, char b, char c, char d) {
+		return uint32_t(uint8_t(a)) << 24 | uint32_t(uint8_t(b)) << 16 | uint32_t(uint8_t(c)) << 8 | uint32_t(uint8_t(d));
+	}
+	constexpr uint32_t tag_head = make_tag('h', 'e', 'a', 'd');
+	constexpr uint32_t tag_maxp = make_tag('m', 'a', 'x', 'p');
+	constexpr uint32_t tag_hhea = make_tag('h', 'h', 'e', 'a');
+	constexpr uint32_t tag_hmtx = make_tag('h', 'm', 't', 'x');
+	constexpr uint32_t tag_loca = make_tag('l', 'o', 'c', 'a');
+	constexpr uint32_t tag_glyf = make_tag('g', 'l', 'y', 'f');
+	constexpr uint32_t tag_cmap = make_tag('c', 'm', 'a', 'p');
+	constexpr uint32_t tag_name = make_tag('n', 'a', 'm', 'e');
+	constexpr uint32_t tag_kern = make_tag('k', 'e', 'r', 'n');
+	constexpr uint32_t tag_gpos = make_tag('G', 'P', 'O', 'S');
+
 	struct TableEntry
 	{
 		uint32_t tag;
-		char tagstr[5];
 		uint32_t checkSum;
 		uint32_t offsetPos;
 		uint32_t length;
 
+		typedef TableLayout<Field<&TableEntry::tag>, Field<&TableEntry::checkSum>, Field<&TableEntry::offsetPos>, Field<&TableEntry::length>> Layout;
+
 		uint32_t parse(const char* data, uint32_t offset) {
-			get4b(&tag, data + offset); memcpy(tagstr, data + offset, sizeof(uint32_t)); tagstr[4] = 0; offset += sizeof(uint32_t);
-			get4b(&checkSum, data + offset); offset += sizeof(uint32_t);
-			get4b(&offsetPos, data + offset); offset += sizeof(uint32_t);
-			get4b(&length, data + offset); offset += sizeof(uint32_t);
-			return offset;
+			return Layout::parse(*this, data, offset);
 		}
 	};
+	//Table directory of one face, a small array sorted by tag
+	struct TableDirectory {
+		static constexpr uint32_t max_tables = 64;
+		TableEntry entries[max_tables];
+		uint32_t num_tables = 0;
+
+		//Reads the directory at directory_offset, -3 if it or one of its tables is outside of length (SIZE_MAX for trusted data)
+		//Fonts with more than max_tables tables keep the ones the parser reads first, a repeated tag keeps its last entry
+		int8_t parse(const char* data, size_t length, uint32_t directory_offset);
+		//Returns nullptr if the face has no such table
+		const TableEntry* find(uint32_t tag) const;
+		void clear() { num_tables = 0; }
+	};
 	struct HeadTable
 	{
 		float tableVersion;
@@ -126,25 +286,14 @@ namespace TTFFontParser {
 		short indexToLocFormat;
 		short glyphDataFormat;
 
+		typedef TableLayout<Field<&HeadTable::tableVersion>, Field<&HeadTable::fontRevision>, Field<&HeadTable::checkSumAdjustment>, Field<&HeadTable::magicNumber>,
+			Field<&HeadTable::flags>, Field<&HeadTable::unitsPerEm>, Field<&HeadTable::createdDate>, Field<&HeadTable::modifiedData>,
+			Field<&HeadTable::xMin>, Field<&HeadTable::yMin>, Field<&HeadTable::xMax>, Field<&HeadTable::yMax>,
+			Field<&HeadTable::macStyle>, Field<&HeadTable::lowestRecPPEM>, Field<&HeadTable::fontDirectionHintl>, Field<&HeadTable::indexToLocFormat>,
+			Field<&HeadTable::glyphDataFormat>> Layout;
+
 		uint32_t parse(const char* data, uint32_t offset) {
-			get4b(&tableVersion, data + offset); offset += sizeof(uint32_t);
-			get4b(&fontRevision, data + offset); offset += sizeof(uint32_t);
-			get4b(&checkSumAdjustment, data + offset); offset += sizeof(uint32_t);
-			get4b(&magicNumber, data + offset); offset += sizeof(uint32_t);
-			get2b(&flags, data + offset); offset += sizeof(uint16_t);
-			get2b(&unitsPerEm, data + offset); offset += sizeof(uint16_t);
-			get8b(&createdDate, data + offset); offset += sizeof(uint64_t);
-			get8b(&modifiedData, data + offset); offset += sizeof(uint64_t);
-			get2b(&xMin, data + offset); offset += sizeof(short);
-			get2b(&yMin, data + offset); offset += sizeof(short);
-			get2b(&xMax, data + offset); offset += sizeof(short);
-			get2b(&yMax, data + offset); offset += sizeof(short);
-			get2b(&macStyle, data + offset); offset += sizeof(uint16_t);
-			get2b(&lowestRecPPEM, data + offset); offset += sizeof(uint16_t);
-			get2b(&fontDirectionHintl, data + offset); offset += sizeof(short);
-			get2b(&indexToLocFormat, data + offset); offset += sizeof(short);
-			get2b(&glyphDataFormat, data + offset); offset += sizeof(short);
-			return offset;
+			return Layout::parse(*this, data, offset);
 		}
 	};
 	struct MaximumProfile
@@ -165,23 +314,13 @@ namespace TTFFontParser {
 		uint16_t maxComponentElements;
 		uint16_t maxComponentDepth;
 
+		typedef TableLayout<Field<&MaximumProfile::version>, Field<&MaximumProfile::numGlyphs>, Field<&MaximumProfile::maxPoints>, Field<&MaximumProfile::maxContours>,
+			Field<&MaximumProfile::maxCompositePoints>, Field<&MaximumProfile::maxCompositeContours>, Field<&MaximumProfile::maxZones>, Field<&MaximumProfile::maxTwilightPoints>,
+			Field<&MaximumProfile::maxStorage>, Field<&MaximumProfile::maxFunctionDefs>, Field<&MaximumProfile::maxInstructionDefs>, Field<&MaximumProfile::maxStackElements>,
+			Field<&MaximumProfile::maxSizeOfInstructions>, Field<&MaximumProfile::maxComponentElements>, Field<&MaximumProfile::maxComponentDepth>> Layout;
+
 		uint32_t parse(const char* data, uint32_t offset) {
-			get4b(&version, data + offset); offset += sizeof(uint32_t);
-			get2b(&numGlyphs, data + offset); offset += sizeof(uint16_t);
-			get2b(&maxPoints, data + offset); offset += sizeof(uint16_t);
-			get2b(&maxContours, data + offset); offset += sizeof(uint16_t);
-			get2b(&maxCompositePoints, data + offset); offset += sizeof(uint16_t);
-			get2b(&maxCompositeContours, data + offset); offset += sizeof(uint16_t);
-			get2b(&maxZones, data + offset); offset += sizeof(uint16_t);
-			get2b(&maxTwilightPoints, data + offset); offset += sizeof(uint16_t);
-			get2b(&maxStorage, data + offset); offset += sizeof(uint16_t);
-			get2b(&maxFunctionDefs, data + offset); offset += sizeof(uint16_t);
-			get2b(&maxInstructionDefs, data + offset); offset += sizeof(uint16_t);
-			get2b(&maxStackElements, data + offset); offset += sizeof(uint16_t);
-			get2b(&maxSizeOfInstructions, data + offset); offset += sizeof(uint16_t);
-			get2b(&maxComponentElements, data + offset); offset += sizeof(uint16_t);
-			get2b(&maxComponentDepth, data + offset); offset += sizeof(uint16_t);
-			return offset;
+			return Layout::parse(*this, data, offset);
 		}
 	};
 	struct NameValue {
@@ -192,16 +331,44 @@ namespace TTFFontParser {
 		uint16_t length;
 		uint16_t offset_value;
 
+		typedef TableLayout<Field<&NameValue::platformID>, Field<&NameValue::encodingID>, Field<&NameValue::languageID>,
+			Field<&NameValue::nameID>, Field<&NameValue::length>, Field<&NameValue::offset_value>> Layout;
+
 		uint32_t parse(const char* data, uint32_t offset) {
-			get2b(&platformID, data + offset); offset += sizeof(uint16_t);
-			get2b(&encodingID, data + offset); offset += sizeof(uint16_t);
-			get2b(&languageID, data + offset); offset += sizeof(uint16_t);
-			get2b(&nameID, data + offset); offset += sizeof(uint16_t);
-			get2b(&length, data + offset); offset += sizeof(uint16_t);
-			get2b(&offset_value, data + offset); offset += sizeof(uint16_t);
-			return offset;
+			return Layout::parse(*this, data, offset);
 		}
 	};
+	//Name record in place in the font buffer, the string is only decoded by to_utf8
+	struct NameRecordView {
+		uint16_t platformID = 0;
+		uint16_t encodingID = 0;
+		uint16_t languageID = 0;
+		uint16_t nameID = 0;
+		const char* string = nullptr; //raw bytes in the font buffer
+		uint16_t length = 0;
+
+		//Unicode and Windows names are UTF-16BE, Macintosh names are single byte (Mac Roman)
+		bool is_utf16() const { return platformID == 0 || platformID == 3; }
+		//Appends the name as UTF-8, unpaired surrogates become U+FFFD
+		void to_utf8(std::string& out) const;
+		//Writes at most capacity bytes, returns the length of the whole UTF-8 string
+		size_t to_utf8(char* out, size_t capacity) const;
+	};
+	//Name table read in place, records are read when they are accessed so indexing names does not allocate
+	struct NameTableView {
+		const char* records = nullptr;
+		const char* strings = nullptr;
+		uint32_t strings_length = 0; //bytes from strings to the end of the table
+		uint16_t count = 0;
+
+		//Returns false if the table is too short for its records
+		bool open(const char* data, uint32_t name_offset, uint32_t name_length);
+		uint16_t size() const { return count; }
+		//Strings outside of the table have length 0
+		NameRecordView get_record(uint16_t index) const;
+		//Best record of a nameID: Windows English (US), other Windows Unicode, Unicode platform, Macintosh English, then any other
+		bool find(uint16_t name_id, NameRecordView& record) const;
+	};
 	struct NameTable {
 		uint16_t format;
 		uint16_t count;
@@ -216,23 +383,22 @@ namespace TTFFontParser {
 			nameRecord.resize(count);
 			for (auto i = 0; i < count; i++) {
 				offset = nameRecord[i].parse(data, offset);
-				if (nameRecord[i].nameID > max_number_of_names)
+				if (nameRecord[i].nameID >= max_number_of_names)
 					continue;
-				char* new_name_string = new char[nameRecord[i].length];
-				memcpy(new_name_string, data + offset_start + stringOffset + nameRecord[i].offset_value, sizeof(char) * nameRecord[i].length);
-				uint16_t string_length = nameRecord[i].length;
-				if (new_name_string[0] == 0) {
-					string_length = string_length >> 1;
-					for (auto j = 0; j < string_length; j++) {
-						new_name_string[j] = new_name_string[j * 2 + 1];
-					}
-				}
+				const char* name_string = data + offset_start + stringOffset + nameRecord[i].offset_value;
+				const uint16_t string_length = nameRecord[i].length;
 				const auto current_name_record_index = uint64_t(nameRecord[i].platformID) << 32 | (uint64_t(nameRecord[i].encodingID) << 16) | (uint64_t(nameRecord[i].languageID));
 				auto& current_name_record = names[current_name_record_index];
 				if (!current_name_record.size())
-					current_name_record.resize(25);
-				current_name_record[nameRecord[i].nameID].assign(new_name_string, string_length);
-				delete[] new_name_string;
+					current_name_record.resize(max_number_of_names);
+				NameRecordView record;
+				record.platformID = nameRecord[i].platformID;
+				record.encodingID = nameRecord[i].encodingID;
+				record.string = name_string;
+				record.length = string_length;
+				std::string& name = current_name_record[nameRecord[i].nameID];
+				name.clear();
+				record.to_utf8(name);
 			}
 			return offset;
 		}
@@ -253,23 +419,13 @@ namespace TTFFontParser {
 		int16_t	metricDataFormat;
 		uint16_t numberOfHMetrics;
 
+		typedef TableLayout<Field<&HHEATable::majorVersion>, Field<&HHEATable::minorVersion>, Field<&HHEATable::Ascender>, Field<&HHEATable::Descender>,
+			Field<&HHEATable::LineGap>, Field<&HHEATable::advanceWidthMax>, Field<&HHEATable::minLeftSideBearing>, Field<&HHEATable::minRightSideBearing>,
+			Field<&HHEATable::xMaxExtent>, Field<&HHEATable::caretSlopeRise>, Field<&HHEATable::caretSlopeRun>, Field<&HHEATable::caretOffset>,
+			Skip<sizeof(int16_t) * 4>, Field<&HHEATable::metricDataFormat>, Field<&HHEATable::numberOfHMetrics>> Layout;
+
 		uint32_t parse(const char* data, uint32_t offset) {
-			get2b(&majorVersion, data + offset); offset += sizeof(uint16_t);
-			get2b(&minorVersion, data + offset); offset += sizeof(uint16_t);
-			get2b(&Ascender, data + offset); offset += sizeof(int16_t);
-			get2b(&Descender, data + offset); offset += sizeof(int16_t);
-			get2b(&LineGap, data + offset); offset += sizeof(int16_t);
-			get2b(&advanceWidthMax, data + offset); offset += sizeof(uint16_t);
-			get2b(&minLeftSideBearing, data + offset); offset += sizeof(int16_t);
-			get2b(&minRightSideBearing, data + offset); offset += sizeof(int16_t);
-			get2b(&xMaxExtent, data + offset); offset += sizeof(int16_t);
-			get2b(&caretSlopeRise, data + offset); offset += sizeof(int16_t);
-			get2b(&caretSlopeRun, data + offset); offset += sizeof(int16_t);
-			get2b(&caretOffset, data + offset); offset += sizeof(int16_t);
-			offset += sizeof(int16_t) * 4;
-			get2b(&metricDataFormat, data + offset); offset += sizeof(int16_t);
-			get2b(&numberOfHMetrics, data + offset); offset += sizeof(uint16_t);
-			return offset;
+			return Layout::parse(*this, data, offset);
 		}
 	};
 	
@@ -288,23 +444,70 @@ namespace TTFFontParser {
 	};
 	struct Curve
 	{
-		float_v2 p0;
-		float_v2 p1;
-		float_v2 c; //control point if is_curve
+		float_v2 p0; //start point
+		float_v2 p1; //end point of a line, control point of a curve
+		float_v2 c; //end point of a curve, glyph center for a line
 		bool is_curve;
 	};
+	//Path and Glyph take the memory resource of the container they are created in (uses-allocator construction),
+	//copies and moves into a container with another resource reallocate there
 	struct Path {
-		std::vector<Curve> geometry;
+		typedef std::pmr::polymorphic_allocator<char> allocator_type;
+		std::pmr::vector<Curve> geometry;
+
+		Path() = default;
+		Path(const Path&) = default;
+		Path(Path&&) = default;
+		Path& operator=(const Path&) = default;
+		Path& operator=(Path&&) = default;
+		explicit Path(const allocator_type& allocator) : geometry(allocator) {}
+		Path(const Path& other, const allocator_type& allocator) : geometry(other.geometry, allocator) {}
+		Path(Path&& other, const allocator_type& allocator) : geometry(std::move(other.geometry), allocator) {}
 	};
+	struct PathRange {
+		uint32_t first_curve;
+		uint32_t num_curves;
+	};
+	//Component of a composite glyph, transformation is a 2x2 matrix followed by the offset
+	struct GlyphComponent {
+		uint16_t glyph_index;
+		float transformation[6];
+	};
+	inline Curve transform_curve(const Curve& curve, const float* transformation) {
+		Curve out;
+		out.p0.x = curve.p0.x * transformation[0] + curve.p0.y * transformation[1] + transformation[4];
+		out.p0.y = curve.p0.x * transformation[2] + curve.p0.y * transformation[3] + transformation[5];
+		out.p1.x = curve.p1.x * transformation[0] + curve.p1.y * transformation[1] + transformation[4];
+		out.p1.y = curve.p1.x * transformation[2] + curve.p1.y * transformation[3] + transformation[5];
+		out.c.x = curve.c.x * transformation[0] + curve.c.y * transformation[1] + transformation[4];
+		out.c.y = curve.c.x * transformation[2] + curve.c.y * transformation[3] + transformation[5];
+		out.is_curve = curve.is_curve;
+		return out;
+	}
 	struct Glyph {
-		uint32_t character;
-		int16_t glyph_index;
-		int16_t num_contours;
-		std::vector<Path> path_list;
-		uint16_t advance_width;
-		int16_t left_side_bearing;
-		int16_t bounding_box[4];
-		float_v2 glyph_center;
+		typedef std::pmr::polymorphic_allocator<char> allocator_type;
+		uint32_t character = 0;
+		int16_t glyph_index = 0;
+		int16_t num_contours = 0;
+		std::pmr::vector<Path> path_list;
+		//Flat geometry: paths [first_path, first_path + num_paths) of the font path_ranges
+		uint32_t first_path = 0;
+		uint32_t num_paths = 0;
+		uint16_t advance_width = 0;
+		int16_t left_side_bearing = 0;
+		int16_t bounding_box[4] = {};
+		float_v2 glyph_center = {};
+		//Composite glyphs parsed with ParseOptions::instance_composites reference their components instead of holding paths, see expand_glyph
+		std::pmr::vector<GlyphComponent> components;
+
+		Glyph() = default;
+		Glyph(const Glyph&) = default;
+		Glyph(Glyph&&) = default;
+		Glyph& operator=(const Glyph&) = default;
+		Glyph& operator=(Glyph&&) = default;
+		explicit Glyph(const allocator_type& allocator) : path_list(allocator), components(allocator) {}
+		Glyph(const Glyph& other, const allocator_type& allocator) : Glyph(allocator) { *this = other; }
+		Glyph(Glyph&& other, const allocator_type& allocator) : Glyph(allocator) { *this = std::move(other); }
 	};
 	struct FontMetaData {
 		uint16_t unitsPerEm;
@@ -312,6 +515,182 @@ namespace TTFFontParser {
 		int16_t Descender;
 		int16_t LineGap;
 	};
+	//Codepoint to glyph index lookup over the cmap segments, memory grows with the number of segments and not with the number of codepoints
+	//Glyph index 0 (missing glyph) means the codepoint is not mapped
+	struct CharacterMap {
+		enum RANGE_TYPE {
+			RANGE_SEQUENTIAL = 0, //glyph_index + (character - start)
+			RANGE_CONSTANT = 1, //glyph_index for every character
+			RANGE_ARRAY = 2 //glyph_ids[glyph_index + (character - start)]
+		};
+		struct CharacterRange {
+			uint32_t start;
+			uint32_t end;
+			uint32_t glyph_index;
+			uint32_t type;
+		};
+		struct UnicodeRange {
+			uint32_t start;
+			uint32_t end;
+		};
+		struct VariationMapping {
+			uint32_t character;
+			uint16_t glyph_index;
+		};
+		struct VariationSelector {
+			uint32_t selector;
+			std::vector<UnicodeRange> default_ranges; //sequences that use the default glyph of the character
+			std::vector<VariationMapping> mappings; //sequences with their own glyph
+		};
+
+		static constexpr uint32_t page_bits = 8;
+		static constexpr uint32_t num_pages = 0x110000 >> page_bits;
+
+		std::vector<CharacterRange> ranges; //sorted by start, not overlapping
+		std::vector<uint16_t> glyph_ids; //format 4 glyphIdArray entries with idDelta applied
+		std::vector<uint32_t> page_ranges; //first range ending in or after each 256 codepoint page, num_pages + 1 entries
+		std::vector<uint32_t> characters; //glyph index to codepoint
+		std::vector<VariationSelector> variation_selectors; //sorted by selector
+
+		void clear() {
+			ranges.clear();
+			glyph_ids.clear();
+			page_ranges.clear();
+			characters.clear();
+			variation_selectors.clear();
+		}
+		//cmap_offset is the start of the cmap table, returns false if no supported subtable was found
+		bool parse(const char* data, uint32_t cmap_offset, uint16_t num_glyphs);
+		void parse_format_4(const char* data, uint32_t subtable_offset);
+		void parse_format_12(const char* data, uint32_t subtable_offset, uint32_t type);
+		void parse_format_14(const char* data, uint32_t subtable_offset);
+		//Sorts the ranges and builds the page hints and the reverse map
+		void finalize(uint16_t num_glyphs);
+
+		uint16_t get_glyph_index(uint32_t character) const {
+			if (page_ranges.empty())
+				return 0;
+			return find_glyph_index(ranges.data(), uint32_t(ranges.size()), glyph_ids.data(), page_ranges.data(), uint32_t(characters.size()), character);
+		}
+		//Lookup over the raw arrays, also used by FontCache
+		static uint16_t find_glyph_index(const CharacterRange* ranges, uint32_t num_ranges, const uint16_t* glyph_ids, const uint32_t* page_ranges, uint32_t num_glyphs, uint32_t character) {
+			if (character >= 0x110000)
+				return 0;
+			const uint32_t page = character >> page_bits;
+			const uint32_t last = (page_ranges[page + 1] < num_ranges) ? page_ranges[page + 1] + 1 : num_ranges;
+			//the first range ending at or after the character, usually the first candidate of the page
+			uint32_t first = page_ranges[page], count = last - first;
+			while (count) {
+				const uint32_t step = count >> 1;
+				if (ranges[first + step].end < character) {
+					first += step + 1;
+					count -= step + 1;
+				}
+				else
+					count = step;
+			}
+			if (first == num_ranges || ranges[first].start > character)
+				return 0;
+			const CharacterRange& range = ranges[first];
+			uint32_t glyph_index;
+			if (range.type == RANGE_SEQUENTIAL)
+				glyph_index = range.glyph_index + (character - range.start);
+			else if (range.type == RANGE_CONSTANT)
+				glyph_index = range.glyph_index;
+			else
+				glyph_index = glyph_ids[range.glyph_index + (character - range.start)];
+			return (glyph_index < num_glyphs) ? uint16_t(glyph_index) : 0;
+		}
+		//Glyph of a variation sequence (cmap format 14), 0 if the font has no entry for the sequence
+		uint16_t get_glyph_index(uint32_t character, uint32_t variation_selector) const;
+		uint32_t get_character(uint16_t glyph_index) const {
+			return glyph_index < characters.size() ? characters[glyph_index] : 0;
+		}
+	};
+
+	//Kerning pairs keyed by glyph index, the pairs of each left glyph are sorted by right glyph
+	struct KerningTable {
+		struct KerningPair {
+			uint32_t glyph_pair; //left << 16 | right
+			int16_t value;
+		};
+		//GPOS pair adjustment format 2, glyph classes over the covered glyph range and a class1 x class2 value matrix
+		struct ClassKerning {
+			uint16_t first_glyph; //first_classes[0] is the class of this glyph
+			uint16_t second_glyph; //second_classes[0] is the class of this glyph
+			uint16_t num_second_classes;
+			std::vector<uint16_t> first_classes; //0xFFFF for glyphs outside of the coverage
+			std::vector<uint16_t> second_classes; //glyphs outside of the range are class 0
+			std::vector<int16_t> values;
+
+			//Returns false if the left glyph is not covered by the subtable
+			bool get_kerning(uint16_t left_glyph, uint16_t right_glyph, int16_t& value) const {
+				return find_kerning(first_glyph, first_classes.data(), uint32_t(first_classes.size()), second_glyph, second_classes.data(), uint32_t(second_classes.size()),
+					num_second_classes, values.data(), left_glyph, right_glyph, value);
+			}
+			//Lookup over the raw arrays, also used by FontCache
+			static bool find_kerning(uint16_t first_glyph, const uint16_t* first_classes, uint32_t num_first, uint16_t second_glyph, const uint16_t* second_classes, uint32_t num_second,
+				uint16_t num_second_classes, const int16_t* values, uint16_t left_glyph, uint16_t right_glyph, int16_t& value) {
+				const uint32_t first_index = uint32_t(left_glyph - first_glyph);
+				if (left_glyph < first_glyph || first_index >= num_first || first_classes[first_index] == 0xFFFF)
+					return false;
+				const uint32_t second_index = uint32_t(right_glyph - second_glyph);
+				const uint16_t second_class = (right_glyph >= second_glyph && second_index < num_second) ? second_classes[second_index] : 0;
+				value = values[uint32_t(first_classes[first_index]) * num_second_classes + second_class];
+				return true;
+			}
+		};
+
+		std::vector<uint32_t> first_pair; //per left glyph, num_glyphs + 1 entries
+		std::vector<uint16_t> right_glyphs;
+		std::vector<int16_t> values;
+		std::vector<ClassKerning> class_subtables; //checked in order after the pairs
+
+		void clear() {
+			first_pair.clear();
+			right_glyphs.clear();
+			values.clear();
+			class_subtables.clear();
+		}
+		bool empty() const {
+			return right_glyphs.empty() && class_subtables.empty();
+		}
+		//Reads the format 0 subtables of the kern table
+		void parse(const char* data, uint32_t kern_offset, uint16_t num_glyphs);
+		//Reads the pair adjustment lookups of the GPOS kern feature, returns false if there are none
+		bool parse_gpos(const char* data, uint32_t gpos_offset, uint32_t gpos_length, uint16_t num_glyphs);
+		//Builds the pair index from unsorted pairs, the first of duplicate pairs wins
+		void build(std::vector<KerningPair>& pairs, uint16_t num_glyphs);
+
+		bool find_pair(uint16_t left_glyph, uint16_t right_glyph, int16_t& value) const {
+			return find_pair(first_pair.data(), uint32_t(first_pair.size()), right_glyphs.data(), values.data(), left_glyph, right_glyph, value);
+		}
+		//Lookup over the raw arrays, also used by FontCache
+		static bool find_pair(const uint32_t* first_pair, uint32_t first_pair_size, const uint16_t* right_glyphs, const int16_t* values, uint16_t left_glyph, uint16_t right_glyph, int16_t& value) {
+			if (uint32_t(left_glyph) + 1 >= first_pair_size)
+				return false;
+			const uint16_t* first = right_glyphs + first_pair[left_glyph];
+			const uint16_t* last = right_glyphs + first_pair[left_glyph + 1];
+			const uint16_t* pair = std::lower_bound(first, last, right_glyph);
+			if (pair == last || *pair != right_glyph)
+				return false;
+			value = values[pair - right_glyphs];
+			return true;
+		}
+		int16_t get_kerning(uint16_t left_glyph, uint16_t right_glyph) const {
+			int16_t value = 0;
+			if (find_pair(left_glyph, right_glyph, value))
+				return value;
+			for (const ClassKerning& class_subtable : class_subtables) {
+				if (class_subtable.get_kerning(left_glyph, right_glyph, value))
+					return value;
+			}
+			return 0;
+		}
+		//adjustments[i] is the kerning between glyph_indices[i] and glyph_indices[i + 1], the last entry is 0
+		void get_kerning(const uint16_t* glyph_indices, size_t count, int16_t* adjustments) const;
+	};
+
 	struct FontData {
 		struct FontNameData {
 			uint16_t platformID;
@@ -335,10 +714,442 @@ namespace TTFFontParser {
 		std::unordered_map<uint64_t, std::vector<std::string>> name_table; //name table per language or platform
 
 		bool has_kearning_table = false;
-		std::unordered_map<uint64_t, int16_t> kearning_table;
+		KerningTable kearning_table;
+
+		std::pmr::unordered_map<uint32_t, Glyph> glyphs;
+		FontMetaData meta_data;
+		CharacterMap character_map;
+
+		//Flat geometry, used instead of Glyph::path_list when ParseOptions::flat_geometry is set
+		std::pmr::vector<PathRange> path_ranges;
+		std::pmr::vector<Curve> curves;
+		//Glyphs without a character that instanced composite glyphs use, by glyph index
+		std::pmr::unordered_map<uint16_t, Glyph> component_glyphs;
+
+		FontData() = default;
+		//Glyphs and geometry are allocated from resource, for example a std::pmr::monotonic_buffer_resource that is released with the font
+		explicit FontData(std::pmr::memory_resource* resource) : glyphs(resource), path_ranges(resource), curves(resource), component_glyphs(resource) {}
+		std::pmr::memory_resource* resource() const { return glyphs.get_allocator().resource(); }
+		const Glyph* get_glyph_by_index(uint16_t glyph_index) const;
+	};
+
+	struct ParseOptions {
+		//Store all curves of the font in one buffer, glyphs reference ranges of it
+		bool flat_geometry = false;
+		//Worker threads for decoding the glyphs of parse_data, 0 uses every hardware thread, 1 decodes on the calling thread
+		uint32_t num_threads = 1;
+		//Face of a font collection (ttc), ignored for single fonts
+		uint32_t face_index = 0;
+		//Reject fonts (-3) whose tables do not match the checksums of their directory, only for calls that get the buffer length
+		bool verify_checksums = false;
+		//Keep composite glyphs as component references (Glyph::components) instead of copies of the transformed component paths
+		bool instance_composites = false;
+		//Allocates the glyphs and geometry of a FontFace, nullptr for the default resource. parse_data uses the resource of its FontData instead
+		//Decode worker threads allocate their glyphs from the default resource, so it does not have to be thread safe
+		std::pmr::memory_resource* memory_resource = nullptr;
+		//Checked between blocks of glyphs, parse_data returns -4 once it is set
+		const std::atomic<bool>* cancel = nullptr;
+	};
+
+	//Single channel signed distance field of a glyph, 8 bit with the outline at 128 and higher values inside
+	//Row 0 is the top row, pixel (x, y) samples the point (left + x + 0.5, top - y - 0.5) of the glyph in pixels
+	struct GlyphSdf {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		int32_t left = 0; //left edge right of the glyph origin
+		int32_t top = 0; //top edge above the baseline
+		std::vector<uint8_t> pixels;
+	};
+	struct SdfOptions {
+		//Pixels per font unit, pixel size / unitsPerEm
+		float scale = 1.f;
+		//Distance in pixels that maps to 0 and 255, the bitmap is padded by it on every side
+		float spread = 4.f;
+		//Distance of the polylines used for the field to the curves, in pixels
+		float tolerance = 0.125f;
+		//Worker threads for build_glyph_sdfs, 0 uses every hardware thread
+		uint32_t num_threads = 0;
+	};
+	//Anti-aliased 8 bit coverage of a glyph, placed like GlyphSdf without the padding
+	struct GlyphBitmap {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		int32_t left = 0;
+		int32_t top = 0;
+		std::vector<uint8_t> pixels;
+	};
+	//Reused by rasterize_glyph calls of one thread
+	struct RasterScratch {
+		std::vector<float_v2> points;
+		std::vector<uint32_t> contour_ends;
+		std::vector<float> accumulation;
+		//Geometry of an instanced composite glyph expanded by GlyphBitmapCache
+		std::vector<PathRange> path_ranges;
+		std::vector<Curve> curves;
+	};
+
+	//Read only contents of a font file, memory mapped where supported and read into memory otherwise
+	struct FontFileBuffer {
+		const char* data = nullptr;
+		size_t length = 0;
+		bool mapped = false;
+		std::string file_contents;
+
+		FontFileBuffer() = default;
+		FontFileBuffer(const FontFileBuffer&) = delete;
+		FontFileBuffer& operator=(const FontFileBuffer&) = delete;
+		~FontFileBuffer() { close(); }
+
+		int8_t open(const char* file_name);
+		void close();
+	};
+
+	//Decoded glyphs of one glyf, loca and hmtx combination, faces of a collection that use the same tables share one store
+	//Glyph::character is set by the face that decoded the glyph, use FontFace::get_character for the other faces
+	struct GlyphStore {
+		//Flat geometry of the glyphs decoded by one worker of FontFace::decode_simple_glyphs
+		struct DecodeBatch {
+			std::pmr::vector<PathRange> path_ranges;
+			std::pmr::vector<Curve> curves;
+		};
+
+		//Tables the glyphs are decoded from
+		const char* data = nullptr;
+		uint32_t glyf_offset = 0;
+		uint32_t loca_offset = 0;
+		uint32_t hmtx_offset = 0;
+		uint16_t num_glyphs = 0;
+		uint16_t number_of_h_metrics = 0;
+		int16_t index_to_loc_format = 0;
+		bool flat_geometry = false;
+
+		std::vector<uint32_t> glyph_offsets; //loca, numGlyphs + 1 offsets into glyf
+		std::pmr::unordered_map<uint16_t, Glyph> glyph_cache;
+		std::vector<uint8_t> glyph_state; //0 not loaded, 1 loading, 2 loaded
+		//Geometry of the decoded glyphs with ParseOptions::flat_geometry
+		std::pmr::vector<PathRange> path_ranges;
+		std::pmr::vector<Curve> curves;
+		//Glyphs decoded ahead by decode_simple_glyphs, taken over by parse_glyph when they are first requested
+		std::vector<Glyph> decoded_glyphs;
+		std::vector<uint16_t> decoded_batch; //index into decode_batches + 1, 0 if the glyph is not decoded ahead
+		std::vector<DecodeBatch> decode_batches;
+
+		GlyphStore() = default;
+		explicit GlyphStore(std::pmr::memory_resource* resource) : glyph_cache(resource), path_ranges(resource), curves(resource) {}
+
+		bool same_tables(const GlyphStore& other) const {
+			return data == other.data && glyf_offset == other.glyf_offset && loca_offset == other.loca_offset && hmtx_offset == other.hmtx_offset &&
+				num_glyphs == other.num_glyphs && number_of_h_metrics == other.number_of_h_metrics && index_to_loc_format == other.index_to_loc_format &&
+				flat_geometry == other.flat_geometry;
+		}
+	};
+
+	//Font face over the original font buffer, glyphs are decoded on first use and cached
+	struct FontFace {
+		struct GlyphDecodeScratch {
+			std::vector<uint16_t> contour_end;
+			std::vector<uint8_t> flags;
+			std::vector<int16_t> x_coordinates;
+			std::vector<int16_t> y_coordinates;
+			std::vector<int16_v2> points;
+			std::vector<GlyphComponent> components; //used as a stack by nested composite glyphs
+		};
+		//Receives the paths of a glyph, either into its path_list or appended to flat buffers
+		struct GeometrySink {
+			Glyph& glyph;
+			std::pmr::vector<PathRange>& path_ranges;
+			std::pmr::vector<Curve>& curves;
+			bool flat_geometry;
+
+			//max_curves reserves the path_list geometry, so each path allocates once
+			void begin_path(uint32_t max_curves = 0) {
+				if (flat_geometry) {
+					path_ranges.push_back({ uint32_t(curves.size()), 0 });
+					glyph.num_paths++;
+				}
+				else
+					glyph.path_list.emplace_back().geometry.reserve(max_curves);
+			}
+			void add_curve(const Curve& curve) {
+				if (flat_geometry) {
+					curves.push_back(curve);
+					path_ranges.back().num_curves++;
+				}
+				else
+					glyph.path_list.back().geometry.push_back(curve);
+			}
+		};
+		ParseOptions options; //set before opening the face
+		const char* data = nullptr;
+		std::shared_ptr<const FontFileBuffer> file; //keeps the mapping alive when opened with open_file
+		TableDirectory tables;
+		HeadTable head_table;
+		MaximumProfile max_profile;
+		HHEATable hhea_table;
+		FontMetaData meta_data;
+
+		CharacterMap character_map;
+		NameTableView name_table; //empty if the font has no name table
+		std::shared_ptr<GlyphStore> glyph_store; //loca and the decoded glyphs, possibly shared with other faces of a collection
+		GlyphDecodeScratch scratch;
+
+		//The buffer has to stay valid for the lifetime of the face, ParseOptions::face_index selects the face of a collection
+		int8_t open(const char* data);
+		//Reuses one of the stores if it was decoded from the same glyf, loca and hmtx tables
+		int8_t open(const char* data, const std::vector<std::shared_ptr<GlyphStore>>& shared_stores);
+		//Validates the font against the buffer length first, use this for untrusted data
+		int8_t open(const char* data, size_t length);
+		//Maps the file and parses directly over the mapping
+		int8_t open_file(const char* file_name);
+		//Returns nullptr if the character is not mapped by the font
+		const Glyph* get_glyph(uint32_t character);
+		//Returns nullptr for an invalid glyph index or a recursive composite glyph
+		const Glyph* get_glyph_by_index(uint16_t glyph_index);
+		bool get_glyph_index(uint32_t character, uint16_t& glyph_index) const;
+		uint32_t get_character(uint16_t glyph_index) const;
+		uint16_t num_glyphs() const { return max_profile.numGlyphs; }
+		//Appends the paths of a glyph with its components resolved and transformed, the output must not be the face geometry
+		void expand_glyph(uint16_t glyph_index, std::vector<PathRange>& path_ranges, std::vector<Curve>& curves);
+		void expand_glyph(uint16_t glyph_index, std::pmr::vector<Path>& path_list);
+
+		//Decodes every glyph without components on num_threads threads (0 for all hardware threads)
+		//Composite glyphs are resolved by get_glyph_by_index after their components, the results match sequential decoding
+		void decode_simple_glyphs(uint32_t num_threads);
+
+		int8_t parse_glyph(uint16_t glyph_index, Glyph& glyph);
+		//Metrics and bounding box, only reads the font so it is safe to call from several threads. Returns -1 if the glyph has no outline
+		int8_t parse_glyph_header(uint16_t glyph_index, Glyph& glyph, uint32_t& outline_offset) const;
+		void parse_simple_glyph(uint32_t outline_offset, uint32_t outline_end, GeometrySink& sink, GlyphDecodeScratch& glyph_scratch) const;
+	};
+
+	//Every face of a font file, a single font has one face. Faces that use the same glyf, loca and hmtx tables share their decoded glyphs,
+	//so a shared store must only be used by one thread at a time
+	struct FontCollection {
+		std::shared_ptr<const FontFileBuffer> file; //keeps the mapping alive when opened with open_file
+		std::vector<FontFace> faces;
+		std::vector<std::shared_ptr<GlyphStore>> glyph_stores; //distinct stores of the faces
+
+		//Validates and opens every face, options.face_index is ignored
+		int8_t open(const char* data, size_t length, const ParseOptions& options = ParseOptions());
+		int8_t open_file(const char* file_name, const ParseOptions& options = ParseOptions());
+		size_t num_faces() const { return faces.size(); }
+	};
+
+	//Push parser for a font that arrives in chunks in file order, for example a progressive download
+	//The table directory is read first, the face opens once head, maxp, hhea, hmtx, cmap and loca have arrived and glyphs become
+	//available as their glyf bytes (and those of their components) arrive. Every table is validated like validate_data as it arrives
+	struct StreamingParser {
+		ParseOptions options; //set before the first push
+		std::vector<char> buffer; //sized to the end of the last table once the directory is read, bytes that did not arrive yet are 0
+		size_t received = 0;
+		size_t expected_length = 0;
+		size_t font_length = 0; //end of the last table of the face
+		TableDirectory tables;
+		FontFace face; //usable once face_ready is set, get_glyph of the face does not check that the glyph has arrived
+		bool directory_ready = false;
+		bool face_ready = false;
+		bool name_ready = false;
+		uint32_t glyphs_arrived = 0; //glyphs in index order whose glyf range is complete and valid, loca is monotonic
+		int8_t error = 0;
+
+		//Starts a new font. expected_length is the file size if it is known (0 otherwise), tables past it are malformed
+		void reset(size_t expected_length = 0);
+		//Appends the next bytes of the file and returns the error code, which stays set until reset
+		int8_t push(const char* chunk, size_t length);
+		bool complete() const { return directory_ready && received >= font_length; }
+		//True once the bytes of the table have arrived
+		bool has_table(uint32_t tag) const;
+		bool has_glyph(uint16_t glyph_index) const;
+		//nullptr until the glyph has arrived
+		const Glyph* get_glyph_by_index(uint16_t glyph_index);
+		const Glyph* get_glyph(uint32_t character);
+		//Parses the complete font into a FontData with the options of the parser, -1 if it has not fully arrived
+		int8_t finish(FontData* font_data) const;
+
+		int8_t read_directory();
+		int8_t update();
+	};
+
+	//Skyline bottom left packer for glyph rectangles in a fixed size atlas, space is only reclaimed by reset
+	struct AtlasPacker {
+		struct SkylineNode {
+			uint32_t x;
+			uint32_t y; //top of the used area below this span
+			uint32_t width;
+		};
+		uint32_t width = 0;
+		uint32_t height = 0;
+		std::vector<SkylineNode> skyline; //sorted by x, covering the whole width
+
+		void reset(uint32_t atlas_width, uint32_t atlas_height);
+		//Places a rectangle at the lowest fitting position, returns false if the atlas is full
+		bool pack(uint32_t rect_width, uint32_t rect_height, uint32_t& x, uint32_t& y);
+	};
+
+	//Rasterized glyphs of one font keyed by glyph index, pixel size and subpixel offset, least recently used glyphs are evicted above byte_budget
+	//With an atlas size every glyph also gets an atlas position. A full atlas evicts every glyph and increments atlas_generation, so the
+	//bitmaps have to be uploaded again. Not thread safe, returned entries are valid until the next get
+	struct GlyphBitmapCache {
+		struct Entry {
+			uint64_t key;
+			GlyphBitmap bitmap;
+			uint32_t atlas_x;
+			uint32_t atlas_y;
+		};
+		size_t byte_budget = size_t(16) << 20; //bitmap bytes
+		uint32_t subpixel_steps = 4; //horizontal subpixel variants per pixel
+		uint32_t atlas_padding = 1; //empty pixels between atlas rectangles
+		AtlasPacker atlas;
+		uint32_t atlas_generation = 0;
+		size_t num_bytes = 0;
+		size_t hits = 0;
+		size_t misses = 0;
+		std::list<Entry> entries; //most recently used first
+		std::unordered_map<uint64_t, std::list<Entry>::iterator> lookup;
+		RasterScratch scratch;
+
+		void reset(uint32_t atlas_width = 0, uint32_t atlas_height = 0);
+		void clear();
+		//pen_x is the pen position in pixels, its fraction selects the subpixel variant that is rasterized, nullptr for a missing glyph
+		//Instanced composite glyphs are expanded into the scratch geometry before they are rasterized
+		const Entry* get(FontFace& face, uint16_t glyph_index, float pixel_size, float pen_x);
+		const Entry* get(const FontData& font_data, uint32_t character, float pixel_size, float pen_x);
+
+		const Entry* get(const Glyph& glyph, const PathRange* path_ranges, const Curve* curves, float units_per_em, float pixel_size, float pen_x);
+	};
+
+	//Flat tables for measuring text without hash lookups, the font data or face has to outlive it
+	struct TextMeasure {
+		std::vector<uint16_t> advance_widths; //by glyph index
+		uint16_t ascii_glyphs[128] = {};
+		std::vector<int16_t> ascii_kerning; //kerning of every pair of ASCII characters (left * 128 + right), empty without kerning
+		const CharacterMap* character_map = nullptr;
+		const KerningTable* kerning_table = nullptr; //nullptr without kerning
+
+		void build(const FontData& font_data);
+		//Advances of every glyph from hmtx, a face has no kerning
+		void build(const FontFace& face);
+		//Advance of the text in font units including kerning, invalid UTF-8 is measured as U+FFFD
+		//positions (one per codepoint, may be nullptr) gets the pen position of every glyph
+		int32_t measure_utf8(const char* text, size_t length, int32_t* positions = nullptr) const;
+		int32_t measure_utf32(const uint32_t* text, size_t length, int32_t* positions = nullptr) const;
+		//The same multiplied by scale, pixel size / unitsPerEm for pixels
+		float measure_utf8(const char* text, size_t length, float scale, float* positions) const;
+		float measure_utf32(const uint32_t* text, size_t length, float scale, float* positions) const;
 
-		std::unordered_map<uint32_t, Glyph> glyphs;
+		uint16_t get_glyph_index(uint32_t character) const {
+			return character < 128 ? ascii_glyphs[character] : character_map->get_glyph_index(character);
+		}
+		uint16_t get_advance(uint16_t glyph_index) const {
+			return glyph_index < advance_widths.size() ? advance_widths[glyph_index] : 0;
+		}
+	};
+
+	//Binary cache of a parsed font, one relocatable blob of flat arrays in host byte order addressed by offsets from its start
+	//Loading maps the blob and checks the header, glyphs, cmap and kerning are then read in place without parsing
+	enum FONT_CACHE_SECTION {
+		FONT_CACHE_GLYPHS = 0, //FontCacheGlyph by glyph index
+		FONT_CACHE_PATH_RANGES, //PathRange
+		FONT_CACHE_CURVES, //Curve
+		FONT_CACHE_CHARACTER_RANGES, //CharacterMap::CharacterRange
+		FONT_CACHE_GLYPH_IDS, //uint16_t
+		FONT_CACHE_PAGE_RANGES, //uint32_t
+		FONT_CACHE_CHARACTERS, //uint32_t
+		FONT_CACHE_KERNING_FIRST_PAIR, //uint32_t
+		FONT_CACHE_KERNING_RIGHT_GLYPHS, //uint16_t
+		FONT_CACHE_KERNING_VALUES, //int16_t
+		FONT_CACHE_CLASS_KERNING, //FontCacheClassKerning
+		FONT_CACHE_CLASS_DATA, //uint16_t, classes and values of the class kerning subtables
+		FONT_CACHE_NAMES, //FontCacheName
+		FONT_CACHE_STRINGS, //char
+		FONT_CACHE_NUM_SECTIONS
+	};
+	struct FontCacheSection {
+		uint64_t offset;
+		uint64_t count;
+	};
+	struct FontCacheGlyph {
+		uint32_t character;
+		uint32_t first_path; //into FONT_CACHE_PATH_RANGES
+		uint32_t num_paths;
+		uint16_t advance_width;
+		int16_t left_side_bearing;
+		int16_t bounding_box[4];
+		int16_t num_contours;
+		uint16_t present; //0 for glyph indices that were not in FontData::glyphs
+		float_v2 glyph_center;
+	};
+	struct FontCacheClassKerning {
+		uint16_t first_glyph;
+		uint16_t second_glyph;
+		uint16_t num_second_classes;
+		uint16_t reserved;
+		//Element offsets and counts in FONT_CACHE_CLASS_DATA
+		uint32_t first_classes;
+		uint32_t num_first_classes;
+		uint32_t second_classes;
+		uint32_t num_second_entries;
+		uint32_t values;
+		uint32_t num_values;
+	};
+	struct FontCacheName {
+		uint16_t platformID;
+		uint16_t encodingID;
+		uint16_t languageID;
+		uint16_t reserved;
+		//Byte offsets and lengths in FONT_CACHE_STRINGS
+		uint32_t font_family;
+		uint32_t font_family_length;
+		uint32_t font_style;
+		uint32_t font_style_length;
+	};
+	struct FontCacheHeader {
+		char magic[8]; //"TTFCACHE"
+		uint32_t version;
+		uint32_t byte_order; //0x01020304 in the byte order of the writer
+		uint64_t blob_size;
+		uint64_t source_key; //font_cache_key of the font the blob was built from
+		uint64_t checksum; //of everything after the header
 		FontMetaData meta_data;
+		uint16_t num_glyphs;
+		uint16_t has_kerning;
+		uint32_t reserved;
+		FontCacheSection sections[FONT_CACHE_NUM_SECTIONS];
+	};
+
+	//Read only view of a cache blob, the blob has to stay valid for the lifetime of the view
+	struct FontCache {
+		static constexpr uint32_t version = 1;
+
+		const char* data = nullptr;
+		size_t length = 0;
+		const FontCacheHeader* header = nullptr;
+		std::shared_ptr<const FontFileBuffer> file; //keeps the mapping alive when opened with open_file
+
+		//The blob has to be 8 byte aligned. source_key 0 skips the source check, verify_checksum hashes the whole blob
+		//Returns -1 if the blob is not a cache of this version and byte order or was built from another font, -3 if it is malformed
+		int8_t open(const char* data, size_t length, uint64_t source_key, bool verify_checksum = false);
+		int8_t open_file(const char* file_name, uint64_t source_key, bool verify_checksum = false);
+
+		template<typename T> const T* section(FONT_CACHE_SECTION index) const {
+			return (const T*)(data + header->sections[index].offset);
+		}
+		uint32_t section_count(FONT_CACHE_SECTION index) const { return uint32_t(header->sections[index].count); }
+
+		uint16_t num_glyphs() const { return header->num_glyphs; }
+		const FontMetaData& meta_data() const { return header->meta_data; }
+		const PathRange* path_ranges() const { return section<PathRange>(FONT_CACHE_PATH_RANGES); }
+		const Curve* curves() const { return section<Curve>(FONT_CACHE_CURVES); }
+		std::string_view get_string(uint32_t offset, uint32_t string_length) const {
+			return std::string_view(section<char>(FONT_CACHE_STRINGS) + offset, string_length);
+		}
+
+		uint16_t get_glyph_index(uint32_t character) const;
+		uint32_t get_character(uint16_t glyph_index) const;
+		//Returns nullptr if the glyph is not in the cache
+		const FontCacheGlyph* get_glyph_by_index(uint16_t glyph_index) const;
+		const FontCacheGlyph* get_glyph(uint32_t character) const;
+		int16_t get_kerning(uint16_t left_glyph, uint16_t right_glyph) const;
 	};
 
 	//For async file read
@@ -349,34 +1160,146 @@ namespace TTFFontParser {
 		void* args;
 	};
 
+#ifdef TTF_FONT_PARSER_THREADS
+	//Fixed set of worker threads, each with its own task queue. Idle workers take tasks from the back of the other queues
+	struct ThreadPool {
+		struct TaskQueue {
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		std::vector<std::thread> workers;
+		std::vector<std::unique_ptr<TaskQueue>> queues;
+		std::mutex sleep_mutex;
+		std::condition_variable wake;
+		std::atomic<size_t> queued_tasks{ 0 };
+		std::atomic<uint32_t> next_queue{ 0 };
+		bool stopping = false; //guarded by sleep_mutex
+
+		//0 starts one worker per hardware thread
+		explicit ThreadPool(uint32_t num_threads = 0);
+		//Runs the queued tasks to completion before joining
+		~ThreadPool();
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		void submit(std::function<void()> task);
+		uint32_t size() const { return uint32_t(workers.size()); }
+
+		bool pop_task(uint32_t worker_index, std::function<void()>& task);
+		void run_worker(uint32_t worker_index);
+	};
+
+	//Shared by a ParseFuture and the task parsing its font
+	struct AsyncParseState {
+		FontData font_data;
+		std::atomic<bool> cancelled{ false };
+		std::mutex mutex;
+		std::condition_variable finished;
+		bool done = false; //guarded by mutex
+		int8_t error = 0;
+
+		explicit AsyncParseState(std::pmr::memory_resource* resource) : font_data(resource) {}
+	};
+	//Handle of a font parsed in the background by parse_file_async. Destroying it does not wait, the task keeps the state alive
+	struct ParseFuture {
+		std::shared_ptr<AsyncParseState> state;
+
+		//A default constructed future has no task, it is never ready, wait returns -1 and get nullptr without blocking
+		bool valid() const { return state != nullptr; }
+		//True once the font is parsed, failed or cancelled, never blocks
+		bool ready() const;
+		//Blocks until the task is finished and returns its error code, -4 if it was cancelled
+		int8_t wait() const;
+		//Returns false if the task did not finish within timeout, true at once without a task
+		bool wait_for(std::chrono::milliseconds timeout) const;
+		//Asks the task to stop, it finishes with -4 before reading the file or at the next block of glyphs. A finished parse keeps its result
+		void cancel();
+		//Waits, then returns the parsed font or nullptr on an error. The font can be moved out of the future
+		FontData* get();
+	};
+#endif
+
 	//Function definitions
 #ifdef __cplusplus
 	extern "C" {
 #endif
 		extern int8_t parse_file(const char* file_name, FontData* font_data, TTF_FONT_PARSER_CALLBACK callback, void* args);
 		extern int8_t parse_data(const char* data, FontData* font_data);
+		//Kerning between two characters
 		extern int16_t get_kearning_offset(FontData* font_data, uint32_t left_glyph, uint32_t right_glyph);
 #ifdef __cplusplus
 	}
+#endif
+	//Kerning of a run of glyph indices, adjustments[i] applies between glyph i and i + 1
+	void get_kearning_offsets(const FontData* font_data, const uint16_t* glyph_indices, size_t count, int16_t* adjustments);
+	//Flattens a closed contour to a polyline: p0 of the first curve, then the end point of every line and curve segment
+	//A curve is split into ceil(sqrt(|p0 - 2 * p1 + c| / (4 * tolerance))) uniform segments, which keeps the polyline within tolerance of the curve
+	//Writes at most max_points points and returns the point count of the whole polyline, so a call with max_points 0 sizes the buffer
+	uint32_t flatten_curves(const Curve* curves, uint32_t num_curves, float tolerance, float_v2* points, uint32_t max_points);
+	//Flattens every path of a glyph into one buffer, path i ends before contour_ends[i] (path_list.size() or num_paths entries, may be nullptr)
+	//path_ranges and curves are the flat geometry of the font, only read when the glyph has no path_list
+	uint32_t flatten_glyph(const Glyph& glyph, const PathRange* path_ranges, const Curve* curves, float tolerance, float_v2* points, uint32_t max_points, uint32_t* contour_ends);
+	uint32_t flatten_glyph(const FontData& font_data, const Glyph& glyph, float tolerance, float_v2* points, uint32_t max_points, uint32_t* contour_ends);
+	//Signed distance field of a glyph with the nonzero fill rule, path_ranges and curves as for flatten_glyph
+	void build_glyph_sdf(const Glyph& glyph, const PathRange* path_ranges, const Curve* curves, const SdfOptions& options, GlyphSdf& sdf);
+	//Builds sdfs[i] for glyphs[i] of count glyphs, spread over options.num_threads threads
+	void build_glyph_sdfs(const Glyph* const* glyphs, size_t count, const PathRange* path_ranges, const Curve* curves, const SdfOptions& options, GlyphSdf* sdfs);
+	//Instanced composite glyphs among glyphs are expanded first
+	void build_glyph_sdfs(const FontData& font_data, const Glyph* const* glyphs, size_t count, const SdfOptions& options, GlyphSdf* sdfs);
+	//Appends the paths of a glyph with instanced components resolved, the same paths a parse without ParseOptions::instance_composites gives
+	//Flattening, sdf and raster functions only use the paths a glyph holds itself, so instanced composite glyphs are expanded first
+	void expand_glyph(const FontData& font_data, const Glyph& glyph, std::vector<PathRange>& path_ranges, std::vector<Curve>& curves);
+	void expand_glyph(const FontData& font_data, const Glyph& glyph, std::pmr::vector<Path>& path_list);
+	//Exact area coverage of the flattened outline (nonzero fill), scale in pixels per font unit and the glyph shifted right by subpixel_x pixels
+	void rasterize_glyph(const Glyph& glyph, const PathRange* path_ranges, const Curve* curves, float scale, float subpixel_x, GlyphBitmap& bitmap, RasterScratch& scratch);
+	//Error codes: -1 unreadable font or file, -2 missing required table, -3 malformed font (offset outside of the buffer), -4 cancelled through ParseOptions::cancel
+	int8_t validate_data(const char* data, size_t length, uint32_t face_index = 0);
+	//OpenType checksum, the sum of the big endian uint32 values of a table with the last one zero padded
+	uint32_t table_checksum(const char* data, uint32_t length);
+	//Compares every table of a face with the checksum of its directory entry, head without checkSumAdjustment. -3 on a mismatch
+	int8_t verify_checksums(const char* data, size_t length, uint32_t face_index = 0);
+	//Stable hash of the tags and computed checksums of the tables of a face, independent of table order and of checkSumAdjustment
+	//Returns 0 if the table directory can not be read
+	uint64_t font_fingerprint(const char* data, size_t length, uint32_t face_index = 0);
+	//Name table of a face read in place without parsing the font, the records point into data
+	int8_t get_name_table(const char* data, size_t length, NameTableView& name_table, uint32_t face_index = 0);
+	//Number of faces, numFonts for a collection (ttcf) and 1 for a single font, 0 if the data is too short
+	uint32_t get_num_faces(const char* data, size_t length);
+	//Offset of the table directory of a face, returns false if there is no such face
+	bool get_face_offset(const char* data, size_t length, uint32_t face_index, uint32_t& directory_offset);
+	//Validates the whole font once, then parses without per read bounds checks
+	int8_t parse_data(const char* data, size_t length, FontData* font_data, const ParseOptions& options = ParseOptions());
+	int8_t parse_data(const char* data, FontData* font_data, const ParseOptions& options);
+	//Parses file_names[i] into font_datas[i] for count files and blocks until every font is parsed
+	//The callback gets each FontData and its error code as soon as that font is done, from the thread that parsed it, so it has to be thread safe
+	//Returns 0 if every font was parsed, otherwise the error of the first failed file in list order
+	int8_t parse_files(const char* const* file_names, size_t count, FontData* font_datas, TTF_FONT_PARSER_CALLBACK callback, void* args,
+		uint32_t num_threads = 0, const ParseOptions& options = ParseOptions());
+	//Key of a font buffer for FontCache, hashes the length and the table directory, which holds a checksum of every table
+	uint64_t font_cache_key(const char* data, size_t length, uint32_t face_index = 0);
+	//Serializes a parsed font with flat or path_list geometry. Variation sequences (cmap format 14) and the raw name_table are not stored
+	void save_font_cache(const FontData& font_data, uint64_t source_key, std::vector<char>& blob);
+	int8_t save_font_cache_file(const char* file_name, const FontData& font_data, uint64_t source_key);
+#ifdef TTF_FONT_PARSER_THREADS
+	int8_t parse_files(ThreadPool& pool, const char* const* file_names, size_t count, FontData* font_datas, TTF_FONT_PARSER_CALLBACK callback, void* args,
+		const ParseOptions& options = ParseOptions());
+	//Reads and parses a file on a worker of the pool and returns at once, ParseOptions::cancel is replaced by the one of the future
+	//The font is allocated from ParseOptions::memory_resource when it is set, the task can release it after wait returns so the resource has to outlive the pool
+	ParseFuture parse_file_async(ThreadPool& pool, const char* file_name, const ParseOptions& options = ParseOptions());
+	//Same on a pool shared by all calls, started on first use with one worker per hardware thread
+	ParseFuture parse_file_async(const char* file_name, const ParseOptions& options = ParseOptions());
 #endif
 };
 
 #ifdef TTF_FONT_PARSER_IMPLEMENTATION
-namespace TTFFontParser {
-	TTF_FONT_MEM_CPY get2b = get2b_le;
-	TTF_FONT_MEM_CPY get4b = get4b_le;
-	TTF_FONT_MEM_CPY get8b = get8b_le;
-	uint32_t little_endian_test = 0x01234567;
-	bool endian_tested = false;
-};
-
 void ttfparser_recv_file_async_callback(void* args, void* data, int length) {
 	TTFFontParser::FileAccessDataPack* data_pack = (TTFFontParser::FileAccessDataPack*)args;
 
 	if (length <= 0)
 		data_pack->callback(data_pack->args, data_pack->font_data, -1);
 	else {
-		int parse_error = TTFFontParser::parse_data((char*)data, data_pack->font_data);
+		int parse_error = TTFFontParser::parse_data((char*)data, size_t(length), data_pack->font_data);
 		data_pack->callback(data_pack->args, data_pack->font_data, parse_error);
 	}
 	delete data_pack;
@@ -387,58 +1310,120 @@ void ttfparser_recv_file_async_error_callback(void* arg) {
 	delete data_pack;
 }
 
-//Copying functions for big and little endian
-void TTFFontParser::get4b_be(void* dst, const char* src) {
-	((uint8_t*)dst)[0] = src[0];
-	((uint8_t*)dst)[1] = src[1];
-	((uint8_t*)dst)[2] = src[2];
-	((uint8_t*)dst)[3] = src[3];
-}
-void TTFFontParser::get4b_le(void* dst, const char* src) {
-	((uint8_t*)dst)[0] = src[3];
-	((uint8_t*)dst)[1] = src[2];
-	((uint8_t*)dst)[2] = src[1];
-	((uint8_t*)dst)[3] = src[0];
-}
-void TTFFontParser::get8b_be(void * dst, const char * src)
-{
-	((uint8_t*)dst)[0] = src[0];
-	((uint8_t*)dst)[1] = src[1];
-	((uint8_t*)dst)[2] = src[2];
-	((uint8_t*)dst)[3] = src[3];
-	((uint8_t*)dst)[4] = src[4];
-	((uint8_t*)dst)[5] = src[5];
-	((uint8_t*)dst)[6] = src[6];
-	((uint8_t*)dst)[7] = src[7];
-}
-void TTFFontParser::get8b_le(void * dst, const char * src)
-{
-	((uint8_t*)dst)[0] = src[7];
-	((uint8_t*)dst)[1] = src[6];
-	((uint8_t*)dst)[2] = src[5];
-	((uint8_t*)dst)[3] = src[4];
-	((uint8_t*)dst)[4] = src[3];
-	((uint8_t*)dst)[5] = src[2];
-	((uint8_t*)dst)[6] = src[1];
-	((uint8_t*)dst)[7] = src[0];
-}
-void TTFFontParser::get2b_be(void* dst, const char* src) {
-	((uint8_t*)dst)[0] = src[0];
-	((uint8_t*)dst)[1] = src[1];
-}
-void TTFFontParser::get2b_le(void* dst, const char* src) {
-	((uint8_t*)dst)[0] = src[1];
-	((uint8_t*)dst)[1] = src[0];
-}
-void TTFFontParser::get1b(void * dst, const char * src)
-{
-	((uint8_t*)dst)[0] = src[0];
-}
 float TTFFontParser::to_2_14_float(int16_t value)
 {
 	return (float(value & 0x3fff) / float(1 << 14)) + (-2 * ((value >> 15) & 0x1) + ((value >> 14) & 0x1));
 }
 
+/*
+* Flags are copied 16 at a time while there is no repeat flag in the block, a repeated flag is expanded with memset
+*/
+const char* TTFFontParser::decode_glyph_flags(const char* src, const char* src_end, uint8_t* flags, uint16_t num_points) {
+	uint32_t j = 0;
+#ifdef TTF_FONT_PARSER_SSE4
+	while (j + 16 <= num_points && src + 16 <= src_end) {
+		const __m128i block = _mm_loadu_si128((const __m128i*)src);
+		uint32_t repeat_mask = uint32_t(_mm_movemask_epi8(_mm_slli_epi16(block, 7 - 3))); //REPEAT_FLAG moved to the sign bit of each byte
+		_mm_storeu_si128((__m128i*)(flags + j), block);
+		if (!repeat_mask) {
+			j += 16;
+			src += 16;
+			continue;
+		}
+#ifdef _MSC_VER
+		unsigned long literal_flags;
+		_BitScanForward(&literal_flags, repeat_mask);
+#else
+		const uint32_t literal_flags = uint32_t(__builtin_ctz(repeat_mask));
+#endif
+		j += literal_flags;
+		src += literal_flags;
+		const uint8_t flag = uint8_t(src[0]);
+		const uint32_t repeat = std::min<uint32_t>(uint8_t(src[1]), num_points - j - 1);
+		memset(flags + j, flag, repeat + 1);
+		j += repeat + 1;
+		src += 2;
+	}
+#else
+	(void)src_end;
+#endif
+	while (j < num_points) {
+		const uint8_t flag = uint8_t(*src++);
+		flags[j++] = flag;
+		if (flag & REPEAT_FLAG) {
+			const uint32_t repeat = std::min<uint32_t>(uint8_t(*src++), num_points - j);
+			memset(flags + j, flag, repeat);
+			j += repeat;
+		}
+	}
+	return src;
+}
+
+/*
+* The vector path decodes 8 points per step: the byte width of every delta is prefix summed into its offset,
+* one byte shuffle gathers the big endian deltas and the coordinates are prefix summed with 16 bit wrap around like the scalar code
+*/
+const char* TTFFontParser::decode_glyph_coordinates(const char* src, const char* src_end, const uint8_t* flags, uint16_t num_points, uint8_t short_bit, uint8_t same_bit, int16_t* coordinates) {
+	uint32_t j = 0;
+	int16_t coordinate = 0;
+#ifdef TTF_FONT_PARSER_SSE4
+	const __m128i short_flag = _mm_set1_epi16(short_bit);
+	const __m128i same_flag = _mm_set1_epi16(same_bit);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i two = _mm_set1_epi16(2);
+	const __m128i zero_byte = _mm_set1_epi16(0x80); //shuffle index that writes 0
+	const __m128i last_lane = _mm_set1_epi16(0x0F0E);
+	__m128i previous = _mm_setzero_si128();
+	while (j + 8 <= num_points && src + 16 <= src_end) {
+		const __m128i lane_flags = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(flags + j)));
+		const __m128i is_short = _mm_cmpeq_epi16(_mm_and_si128(lane_flags, short_flag), short_flag);
+		const __m128i is_same = _mm_cmpeq_epi16(_mm_and_si128(lane_flags, same_flag), same_flag);
+		const __m128i is_word = _mm_cmpeq_epi16(_mm_or_si128(is_short, is_same), _mm_setzero_si128());
+		const __m128i is_repeated = _mm_andnot_si128(is_short, is_same); //same as the previous coordinate, no delta stored
+		const __m128i is_negative = _mm_andnot_si128(is_same, is_short);
+
+		__m128i width = _mm_or_si128(_mm_and_si128(is_short, one), _mm_and_si128(is_word, two));
+		__m128i end = _mm_add_epi16(width, _mm_slli_si128(width, 2));
+		end = _mm_add_epi16(end, _mm_slli_si128(end, 4));
+		end = _mm_add_epi16(end, _mm_slli_si128(end, 8));
+		const __m128i start = _mm_sub_epi16(end, width);
+
+		//Low byte of a lane is the last byte of its delta, the high byte is the first byte of a 2 byte delta
+		const __m128i low_index = _mm_or_si128(_mm_add_epi16(start, _mm_and_si128(is_word, one)), _mm_and_si128(is_repeated, zero_byte));
+		const __m128i high_index = _mm_or_si128(_mm_and_si128(is_word, start), _mm_andnot_si128(is_word, zero_byte));
+		const __m128i gather = _mm_or_si128(low_index, _mm_slli_epi16(high_index, 8));
+		__m128i delta = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), gather);
+		delta = _mm_sub_epi16(_mm_xor_si128(delta, is_negative), is_negative);
+
+		delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 2));
+		delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 4));
+		delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 8));
+		previous = _mm_add_epi16(delta, previous);
+		_mm_storeu_si128((__m128i*)(coordinates + j), previous);
+		previous = _mm_shuffle_epi8(previous, last_lane);
+
+		src += _mm_extract_epi16(end, 7);
+		j += 8;
+	}
+	coordinate = int16_t(_mm_cvtsi128_si32(previous));
+#else
+	(void)src_end;
+#endif
+	for (; j < num_points; j++) {
+		const uint8_t flag = flags[j];
+		if (flag & short_bit) {
+			const int16_t delta = int16_t(uint8_t(*src++));
+			coordinate = int16_t(coordinate + ((flag & same_bit) ? delta : -delta));
+		}
+		else if (!(flag & same_bit)) {
+			coordinate = int16_t(coordinate + read_be<int16_t>(src));
+			src += sizeof(int16_t);
+		}
+		coordinates[j] = coordinate;
+	}
+	return src;
+}
+
 int8_t TTFFontParser::parse_file(const char* file_name, TTFFontParser::FontData* font_data, TTFFontParser::TTF_FONT_PARSER_CALLBACK callback, void* args) {
 #ifdef __EMSCRIPTEN__
 	FileAccessDataPack* data_pack = new FileAccessDataPack();
@@ -448,601 +1433,3333 @@ int8_t TTFFontParser::parse_file(const char* file_name, TTFFontParser::FontData*
 	emscripten_async_wget_data(file_name, data_pack, ttfparser_recv_file_async_callback, ttfparser_recv_file_async_error_callback);
 	return 0;
 #else
-	std::string data_str;
-	std::ifstream file(file_name, std::ifstream::binary);
-	if (file) {
-		file.seekg(0, std::ios::end);
-		data_str.reserve(file.tellg());
-		file.seekg(0, std::ios::beg);
-		data_str.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-		file.close();
-	}
-	else {
+	FontFileBuffer file;
+	if (file.open(file_name)) {
 		callback(args, font_data, -1);
 		return -1;
 	}
 
-	int error = parse_data(data_str.data(), font_data);
+	int error = parse_data(file.data, file.length, font_data);
 	callback(args, font_data, error);
 	return error;
 #endif
 }
 
-/*
-* Parse a ttf font and output glyph data into FontData
-*/
-int8_t TTFFontParser::parse_data(const char* data, TTFFontParser::FontData* font_data) {
-	if (endian_tested == false) {
-		if (((*((uint8_t*)(&TTFFontParser::little_endian_test))) == 0x67) == true) {
-			TTFFontParser::get2b = TTFFontParser::get2b_le;
-			TTFFontParser::get4b = TTFFontParser::get4b_le;
-			TTFFontParser::get8b = TTFFontParser::get8b_le;
-		}
-		else {
-			TTFFontParser::get2b = TTFFontParser::get2b_be;
-			TTFFontParser::get4b = TTFFontParser::get4b_be;
-			TTFFontParser::get8b = TTFFontParser::get8b_be;
-		}
-		endian_tested = true;
+int8_t TTFFontParser::parse_files(const char* const* file_names, size_t count, TTFFontParser::FontData* font_datas, TTFFontParser::TTF_FONT_PARSER_CALLBACK callback, void* args,
+	uint32_t num_threads, const TTFFontParser::ParseOptions& options) {
+#ifdef TTF_FONT_PARSER_THREADS
+	if (count > 1 && num_threads != 1) {
+		if (num_threads == 0)
+			num_threads = std::thread::hardware_concurrency();
+		ThreadPool pool(uint32_t(std::min<size_t>(std::max<uint32_t>(num_threads, 1), count)));
+		return parse_files(pool, file_names, count, font_datas, callback, args, options);
+	}
+#endif
+	int8_t first_error = 0;
+	for (size_t i = 0; i < count; i++) {
+#ifdef __EMSCRIPTEN__
+		int8_t error = parse_file(file_names[i], &font_datas[i], callback, args);
+#else
+		FontFileBuffer file;
+		int8_t error = file.open(file_names[i]);
+		if (!error)
+			error = parse_data(file.data, file.length, &font_datas[i], options);
+		callback(args, &font_datas[i], error);
+#endif
+		if (error && !first_error)
+			first_error = error;
+	}
+	return first_error;
+}
+
+#ifdef TTF_FONT_PARSER_THREADS
+int8_t TTFFontParser::parse_files(TTFFontParser::ThreadPool& pool, const char* const* file_names, size_t count, TTFFontParser::FontData* font_datas, TTFFontParser::TTF_FONT_PARSER_CALLBACK callback, void* args,
+	const TTFFontParser::ParseOptions& options) {
+	std::vector<int8_t> errors(count, 0);
+	size_t remaining = count;
+	std::mutex done_mutex;
+	std::condition_variable done;
+	for (size_t i = 0; i < count; i++) {
+		pool.submit([&, i]() {
+			FontFileBuffer file;
+			int8_t error = file.open(file_names[i]);
+			if (!error)
+				error = parse_data(file.data, file.length, &font_datas[i], options);
+			errors[i] = error;
+			callback(args, &font_datas[i], error);
+			std::lock_guard<std::mutex> lock(done_mutex);
+			if (--remaining == 0)
+				done.notify_all();
+		});
+	}
+	std::unique_lock<std::mutex> lock(done_mutex);
+	done.wait(lock, [&remaining]() { return remaining == 0; });
+	for (int8_t error : errors) {
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+TTFFontParser::ParseFuture TTFFontParser::parse_file_async(TTFFontParser::ThreadPool& pool, const char* file_name, const TTFFontParser::ParseOptions& options) {
+	ParseFuture future;
+	future.state = std::make_shared<AsyncParseState>(options.memory_resource ? options.memory_resource : std::pmr::get_default_resource());
+	pool.submit([state = future.state, path = std::string(file_name), options]() {
+		int8_t error = -4;
+		if (!state->cancelled.load(std::memory_order_relaxed)) {
+			FontFileBuffer file;
+			error = file.open(path.c_str());
+			if (!error && state->cancelled.load(std::memory_order_relaxed))
+				error = -4;
+			if (!error) {
+				ParseOptions task_options = options;
+				task_options.cancel = &state->cancelled;
+				error = parse_data(file.data, file.length, &state->font_data, task_options);
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->error = error;
+			state->done = true;
+		}
+		state->finished.notify_all();
+	});
+	return future;
+}
+
+TTFFontParser::ParseFuture TTFFontParser::parse_file_async(const char* file_name, const TTFFontParser::ParseOptions& options) {
+	static ThreadPool pool;
+	return parse_file_async(pool, file_name, options);
+}
+
+bool TTFFontParser::ParseFuture::ready() const {
+	if (!valid())
+		return false;
+	std::lock_guard<std::mutex> lock(state->mutex);
+	return state->done;
+}
+
+int8_t TTFFontParser::ParseFuture::wait() const {
+	if (!valid())
+		return -1;
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->finished.wait(lock, [this]() { return state->done; });
+	return state->error;
+}
+
+bool TTFFontParser::ParseFuture::wait_for(std::chrono::milliseconds timeout) const {
+	if (!valid())
+		return true;
+	std::unique_lock<std::mutex> lock(state->mutex);
+	return state->finished.wait_for(lock, timeout, [this]() { return state->done; });
+}
+
+void TTFFontParser::ParseFuture::cancel() {
+	if (valid())
+		state->cancelled.store(true, std::memory_order_relaxed);
+}
+
+TTFFontParser::FontData* TTFFontParser::ParseFuture::get() {
+	return wait() == 0 ? &state->font_data : nullptr;
+}
+
+TTFFontParser::ThreadPool::ThreadPool(uint32_t num_threads) {
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	for (uint32_t i = 0; i < num_threads; i++)
+		queues.emplace_back(new TaskQueue());
+	workers.reserve(num_threads);
+	for (uint32_t i = 0; i < num_threads; i++)
+		workers.emplace_back(&ThreadPool::run_worker, this, i);
+}
+
+TTFFontParser::ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+void TTFFontParser::ThreadPool::submit(std::function<void()> task) {
+	TaskQueue& queue = *queues[next_queue.fetch_add(1) % queues.size()];
+	{
+		//Counted under the sleep lock before the push, so a worker can not miss the wake up or take the task before it is counted
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		queued_tasks++;
 	}
-
-	uint32_t ptr = 0;
-	TTFHeader header;
-	ptr = header.parse(data, ptr);
-	std::unordered_map<std::string, TableEntry> table_map;
-	for (uint16_t i = 0; i < header.numTables; i++)
 	{
-		TableEntry te;
-		ptr = te.parse(data, ptr);
-		table_map[te.tagstr] = te;
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+	wake.notify_one();
+}
+
+bool TTFFontParser::ThreadPool::pop_task(uint32_t worker_index, std::function<void()>& task) {
+	for (size_t i = 0; i < queues.size(); i++) {
+		TaskQueue& queue = *queues[(worker_index + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+			continue;
+		if (i == 0) { //own queue in submission order, stolen tasks from the back
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		else {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		queued_tasks--;
+		return true;
+	}
+	return false;
+}
+
+void TTFFontParser::ThreadPool::run_worker(uint32_t worker_index) {
+	std::function<void()> task;
+	for (;;) {
+		if (pop_task(worker_index, task)) {
+			task();
+			task = nullptr;
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		wake.wait(lock, [this]() { return stopping || queued_tasks > 0; });
+		if (stopping && queued_tasks == 0)
+			return;
+	}
+}
+#endif
+
+int8_t TTFFontParser::FontFileBuffer::open(const char* file_name) {
+	close();
+#ifdef TTF_FONT_PARSER_MMAP
+	int file_descriptor = ::open(file_name, O_RDONLY);
+	if (file_descriptor < 0)
+		return -1;
+	struct stat file_stat;
+	if (fstat(file_descriptor, &file_stat) != 0 || file_stat.st_size <= 0) {
+		::close(file_descriptor);
+		return -1;
+	}
+	void* mapping = mmap(nullptr, size_t(file_stat.st_size), PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+	::close(file_descriptor); //the mapping keeps its own reference to the file
+	if (mapping != MAP_FAILED) {
+		data = (const char*)mapping;
+		length = size_t(file_stat.st_size);
+		mapped = true;
+		return 0;
+	}
+#endif
+#ifndef __EMSCRIPTEN__
+	std::ifstream file_stream(file_name, std::ifstream::binary);
+	if (!file_stream)
+		return -1;
+	file_stream.seekg(0, std::ios::end);
+	const std::streamoff file_size = file_stream.tellg();
+	if (file_size <= 0)
+		return -1;
+	file_contents.resize(size_t(file_size));
+	file_stream.seekg(0, std::ios::beg);
+	if (!file_stream.read(&file_contents[0], file_size)) {
+		file_contents.clear();
+		return -1;
+	}
+	data = file_contents.data();
+	length = file_contents.size();
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+void TTFFontParser::FontFileBuffer::close() {
+#ifdef TTF_FONT_PARSER_MMAP
+	if (mapped)
+		munmap((void*)data, length);
+#endif
+	file_contents.clear();
+	file_contents.shrink_to_fit();
+	data = nullptr;
+	length = 0;
+	mapped = false;
+}
+
+int8_t TTFFontParser::FontFace::open_file(const char* file_name) {
+	auto file_buffer = std::make_shared<FontFileBuffer>();
+	if (file_buffer->open(file_name))
+		return -1;
+	int8_t error = open(file_buffer->data, file_buffer->length);
+	file = std::move(file_buffer);
+	return error;
+}
+
+/*
+* Check every offset the parser follows against the buffer length once, so decoding can run without per read checks
+*/
+uint32_t TTFFontParser::get_num_faces(const char* data, size_t length) {
+	if (length < TTFHeader::Layout::size)
+		return 0;
+	if (read_be<uint32_t>(data) != 0x74746366) //'ttcf'
+		return 1;
+	if (length < CollectionHeader::Layout::size)
+		return 0;
+	CollectionHeader header;
+	header.parse(data, 0);
+	return uint32_t(std::min<uint64_t>(header.numFonts, (length - CollectionHeader::Layout::size) / sizeof(uint32_t)));
+}
+
+bool TTFFontParser::get_face_offset(const char* data, size_t length, uint32_t face_index, uint32_t& directory_offset) {
+	if (face_index >= get_num_faces(data, length))
+		return false;
+	directory_offset = 0;
+	if (read_be<uint32_t>(data) == 0x74746366)
+		directory_offset = read_be<uint32_t>(data + CollectionHeader::Layout::size + face_index * sizeof(uint32_t));
+	return true;
+}
+
+namespace TTFFontParser {
+	//Mac Roman 0x80 - 0xFF
+	constexpr uint16_t mac_roman_characters[128] = {
+		0x00C4, 0x00C5, 0x00C7, 0x00C9, 0x00D1, 0x00D6, 0x00DC, 0x00E1, 0x00E0, 0x00E2, 0x00E4, 0x00E3, 0x00E5, 0x00E7, 0x00E9, 0x00E8,
+		0x00EA, 0x00EB, 0x00ED, 0x00EC, 0x00EE, 0x00EF, 0x00F1, 0x00F3, 0x00F2, 0x00F4, 0x00F6, 0x00F5, 0x00FA, 0x00F9, 0x00FB, 0x00FC,
+		0x2020, 0x00B0, 0x00A2, 0x00A3, 0x00A7, 0x2022, 0x00B6, 0x00DF, 0x00AE, 0x00A9, 0x2122, 0x00B4, 0x00A8, 0x2260, 0x00C6, 0x00D8,
+		0x221E, 0x00B1, 0x2264, 0x2265, 0x00A5, 0x00B5, 0x2202, 0x2211, 0x220F, 0x03C0, 0x222B, 0x00AA, 0x00BA, 0x03A9, 0x00E6, 0x00F8,
+		0x00BF, 0x00A1, 0x00AC, 0x221A, 0x0192, 0x2248, 0x2206, 0x00AB, 0x00BB, 0x2026, 0x00A0, 0x00C0, 0x00C3, 0x00D5, 0x0152, 0x0153,
+		0x2013, 0x2014, 0x201C, 0x201D, 0x2018, 0x2019, 0x00F7, 0x25CA, 0x00FF, 0x0178, 0x2044, 0x20AC, 0x2039, 0x203A, 0xFB01, 0xFB02,
+		0x2021, 0x00B7, 0x201A, 0x201E, 0x2030, 0x00C2, 0x00CA, 0x00C1, 0x00CB, 0x00C8, 0x00CD, 0x00CE, 0x00CF, 0x00CC, 0x00D3, 0x00D4,
+		0xF8FF, 0x00D2, 0x00DA, 0x00DB, 0x00D9, 0x0131, 0x02C6, 0x02DC, 0x00AF, 0x02D8, 0x02D9, 0x02DA, 0x00B8, 0x02DD, 0x02DB, 0x02C7
+	};
+
+	//Calls write(byte) for the UTF-8 bytes of every character of a name
+	template<typename Write>
+	void decode_name(const NameRecordView& record, Write write) {
+		auto encode = [&write](uint32_t character) {
+			if (character < 0x80)
+				write(char(character));
+			else if (character < 0x800) {
+				write(char(0xC0 | (character >> 6)));
+				write(char(0x80 | (character & 0x3F)));
+			}
+			else if (character < 0x10000) {
+				write(char(0xE0 | (character >> 12)));
+				write(char(0x80 | ((character >> 6) & 0x3F)));
+				write(char(0x80 | (character & 0x3F)));
+			}
+			else {
+				write(char(0xF0 | (character >> 18)));
+				write(char(0x80 | ((character >> 12) & 0x3F)));
+				write(char(0x80 | ((character >> 6) & 0x3F)));
+				write(char(0x80 | (character & 0x3F)));
+			}
+		};
+		if (record.is_utf16()) {
+			const uint32_t num_units = record.length / 2u;
+			for (uint32_t i = 0; i < num_units; i++) {
+				uint32_t character = read_be<uint16_t>(record.string + i * 2);
+				if (character >= 0xD800 && character <= 0xDBFF && i + 1 < num_units) {
+					const uint32_t low = read_be<uint16_t>(record.string + (i + 1) * 2);
+					if (low >= 0xDC00 && low <= 0xDFFF) {
+						character = 0x10000 + ((character - 0xD800) << 10) + (low - 0xDC00);
+						i++;
+					}
+				}
+				if (character >= 0xD800 && character <= 0xDFFF)
+					character = 0xFFFD;
+				encode(character);
+			}
+		}
+		else {
+			for (uint32_t i = 0; i < record.length; i++) {
+				const uint8_t byte = uint8_t(record.string[i]);
+				if (byte < 0x80)
+					encode(byte);
+				else
+					encode(record.platformID == 1 && record.encodingID == 0 ? mac_roman_characters[byte - 0x80] : 0xFFFD);
+			}
+		}
+	}
+}
+
+void TTFFontParser::NameRecordView::to_utf8(std::string& out) const {
+	out.reserve(out.size() + length);
+	decode_name(*this, [&out](char byte) { out.push_back(byte); });
+}
+
+size_t TTFFontParser::NameRecordView::to_utf8(char* out, size_t capacity) const {
+	size_t written = 0;
+	decode_name(*this, [out, capacity, &written](char byte) {
+		if (written < capacity)
+			out[written] = byte;
+		written++;
+	});
+	return written;
+}
+
+bool TTFFontParser::NameTableView::open(const char* data, uint32_t name_offset, uint32_t name_length) {
+	*this = NameTableView();
+	if (name_length < 3 * sizeof(uint16_t))
+		return false;
+	const uint16_t num_records = read_be<uint16_t>(data + name_offset + sizeof(uint16_t));
+	const uint16_t string_offset = read_be<uint16_t>(data + name_offset + 2 * sizeof(uint16_t));
+	if (3 * sizeof(uint16_t) + uint32_t(num_records) * NameValue::Layout::size > name_length || string_offset > name_length)
+		return false;
+	records = data + name_offset + 3 * sizeof(uint16_t);
+	strings = data + name_offset + string_offset;
+	strings_length = name_length - string_offset;
+	count = num_records;
+	return true;
+}
+
+TTFFontParser::NameRecordView TTFFontParser::NameTableView::get_record(uint16_t index) const {
+	NameRecordView record;
+	if (index >= count)
+		return record;
+	NameValue value;
+	value.parse(records, uint32_t(index) * NameValue::Layout::size);
+	record.platformID = value.platformID;
+	record.encodingID = value.encodingID;
+	record.languageID = value.languageID;
+	record.nameID = value.nameID;
+	record.string = strings + value.offset_value;
+	record.length = (uint32_t(value.offset_value) + value.length <= strings_length) ? value.length : 0;
+	return record;
+}
+
+bool TTFFontParser::NameTableView::find(uint16_t name_id, NameRecordView& record) const {
+	int32_t best_score = -1;
+	for (uint16_t i = 0; i < count; i++) {
+		if (read_be<uint16_t>(records + uint32_t(i) * NameValue::Layout::size + 3 * sizeof(uint16_t)) != name_id)
+			continue;
+		const NameRecordView candidate = get_record(i);
+		int32_t score = 0;
+		if (candidate.platformID == 3 && (candidate.encodingID == 1 || candidate.encodingID == 10))
+			score = candidate.languageID == 0x409 ? 4 : 3;
+		else if (candidate.platformID == 0)
+			score = 2;
+		else if (candidate.platformID == 1 && candidate.encodingID == 0 && candidate.languageID == 0)
+			score = 1;
+		if (score > best_score) {
+			best_score = score;
+			record = candidate;
+		}
+	}
+	return best_score >= 0;
+}
+
+namespace TTFFontParser {
+	inline bool is_parsed_table(uint32_t tag) {
+		return tag == tag_head || tag == tag_maxp || tag == tag_hhea || tag == tag_hmtx || tag == tag_loca || tag == tag_glyf ||
+			tag == tag_cmap || tag == tag_name || tag == tag_kern || tag == tag_gpos;
+	}
+	//Order independent combination of the table checksums, each table is mixed on its own (splitmix64) and summed
+	inline uint64_t fingerprint_table(uint32_t tag, uint32_t checksum) {
+		uint64_t hash = (uint64_t(tag) << 32 | checksum) + 0x9E3779B97F4A7C15ull;
+		hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+		hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+		return hash ^ (hash >> 31);
+	}
+	//Checksum of a table as stored in the directory, checkSumAdjustment of head counts as 0
+	inline uint32_t directory_checksum(const char* data, const TableEntry& table_entry) {
+		uint32_t checksum = table_checksum(data + table_entry.offsetPos, table_entry.length);
+		if (table_entry.tag == tag_head && table_entry.length >= sizeof(uint32_t) * 3)
+			checksum -= read_be<uint32_t>(data + table_entry.offsetPos + sizeof(uint32_t) * 2);
+		return checksum;
+	}
+	//Calls visit(entry) for every entry of the directory of a face, -1 if there is no such face and -3 if a table is outside of length
+	template<typename Visit>
+	int8_t for_each_table(const char* data, size_t length, uint32_t face_index, Visit visit) {
+		uint32_t directory_offset;
+		if (!get_face_offset(data, length, face_index, directory_offset))
+			return length < TTFHeader::Layout::size ? -3 : -1;
+		if (uint64_t(directory_offset) + TTFHeader::Layout::size > length)
+			return -3;
+		TTFHeader header;
+		uint32_t ptr = header.parse(data, directory_offset);
+		if (uint64_t(ptr) + uint64_t(header.numTables) * TableEntry::Layout::size > length)
+			return -3;
+		for (uint16_t i = 0; i < header.numTables; i++) {
+			TableEntry table_entry;
+			ptr = table_entry.parse(data, ptr);
+			if (uint64_t(table_entry.offsetPos) + table_entry.length > length)
+				return -3;
+			visit(table_entry);
+		}
+		return 0;
+	}
+}
+
+/*
+* Entries are inserted sorted by tag. When a font has more tables than fit, the tables the parser reads are taken in a first pass
+*/
+int8_t TTFFontParser::TableDirectory::parse(const char* data, size_t length, uint32_t directory_offset) {
+	num_tables = 0;
+	if (uint64_t(directory_offset) + TTFHeader::Layout::size > length)
+		return -3;
+	TTFHeader header;
+	const uint32_t first_entry = header.parse(data, directory_offset);
+	if (uint64_t(first_entry) + uint64_t(header.numTables) * TableEntry::Layout::size > length)
+		return -3;
+	const bool overflow = header.numTables > max_tables;
+	for (int pass = overflow ? 0 : 1; pass < 2; pass++) {
+		uint32_t ptr = first_entry;
+		for (uint16_t i = 0; i < header.numTables; i++) {
+			TableEntry table_entry;
+			ptr = table_entry.parse(data, ptr);
+			if (uint64_t(table_entry.offsetPos) + table_entry.length > length)
+				return -3;
+			if (overflow && (pass == 0) != is_parsed_table(table_entry.tag))
+				continue;
+			TableEntry* position = std::lower_bound(entries, entries + num_tables, table_entry.tag,
+				[](const TableEntry& entry, uint32_t tag) { return entry.tag < tag; });
+			if (position != entries + num_tables && position->tag == table_entry.tag) {
+				*position = table_entry;
+				continue;
+			}
+			if (num_tables == max_tables)
+				continue;
+			std::move_backward(position, entries + num_tables, entries + num_tables + 1);
+			*position = table_entry;
+			num_tables++;
+		}
+	}
+	return 0;
+}
+
+const TTFFontParser::TableEntry* TTFFontParser::TableDirectory::find(uint32_t tag) const {
+	const TableEntry* position = std::lower_bound(entries, entries + num_tables, tag,
+		[](const TableEntry& entry, uint32_t key) { return entry.tag < key; });
+	return position != entries + num_tables && position->tag == tag ? position : nullptr;
+}
+
+/*
+* Four big endian words are summed per step, the byte swap is a shuffle
+*/
+uint32_t TTFFontParser::table_checksum(const char* data, uint32_t length) {
+	uint32_t checksum = 0;
+	uint32_t i = 0;
+#ifdef TTF_FONT_PARSER_SSE4
+	const __m128i swap_bytes = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	__m128i sum0 = _mm_setzero_si128();
+	__m128i sum1 = _mm_setzero_si128();
+	for (; i + 32 <= length; i += 32) {
+		sum0 = _mm_add_epi32(sum0, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i)), swap_bytes));
+		sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i + 16)), swap_bytes));
+	}
+	sum0 = _mm_add_epi32(sum0, sum1);
+	sum0 = _mm_add_epi32(sum0, _mm_shuffle_epi32(sum0, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum0 = _mm_add_epi32(sum0, _mm_shuffle_epi32(sum0, _MM_SHUFFLE(2, 3, 0, 1)));
+	checksum = uint32_t(_mm_cvtsi128_si32(sum0));
+#endif
+	for (; i + sizeof(uint32_t) <= length; i += sizeof(uint32_t))
+		checksum += read_be<uint32_t>(data + i);
+	if (i < length) {
+		char last[sizeof(uint32_t)] = {};
+		memcpy(last, data + i, length - i);
+		checksum += read_be<uint32_t>(last);
+	}
+	return checksum;
+}
+
+int8_t TTFFontParser::verify_checksums(const char* data, size_t length, uint32_t face_index) {
+	bool matches = true;
+	int8_t error = for_each_table(data, length, face_index, [data, &matches](const TableEntry& table_entry) {
+		if (matches && directory_checksum(data, table_entry) != table_entry.checkSum)
+			matches = false;
+	});
+	if (error)
+		return error;
+	return matches ? 0 : -3;
+}
+
+uint64_t TTFFontParser::font_fingerprint(const char* data, size_t length, uint32_t face_index) {
+	uint64_t fingerprint = 0;
+	uint32_t num_tables = 0;
+	int8_t error = for_each_table(data, length, face_index, [data, &fingerprint, &num_tables](const TableEntry& table_entry) {
+		fingerprint += fingerprint_table(table_entry.tag, directory_checksum(data, table_entry));
+		num_tables++;
+	});
+	if (error)
+		return 0;
+	return fingerprint_table(num_tables, uint32_t(fingerprint)) ^ fingerprint;
+}
+
+int8_t TTFFontParser::get_name_table(const char* data, size_t length, NameTableView& name_table, uint32_t face_index) {
+	name_table = NameTableView();
+	uint32_t directory_offset;
+	if (!get_face_offset(data, length, face_index, directory_offset))
+		return -1;
+	TableDirectory tables;
+	int8_t error = tables.parse(data, length, directory_offset);
+	if (error)
+		return error;
+	const TableEntry* name_entry = tables.find(tag_name);
+	if (!name_entry)
+		return -2;
+	if (!name_table.open(data, name_entry->offsetPos, name_entry->length))
+		return -3;
+	return 0;
+}
+
+namespace TTFFontParser {
+	//Nesting limit of instanced composites and of streamed composites, also stops reference cycles
+	constexpr uint32_t max_component_depth = 16;
+
+	//Walks a glyph record to make sure it fits inside its loca range, empty glyphs are valid
+	inline int8_t validate_glyph(const char* glyph_data, uint64_t glyph_length, uint32_t num_glyphs) {
+		if (glyph_length == 0)
+			return 0;
+		uint64_t current_offset = sizeof(int16_t) * 5;
+		if (glyph_length < current_offset)
+			return -3;
+		const int16_t num_contours = read_be<int16_t>(glyph_data);
+		if (num_contours > 0) {
+			if (current_offset + uint64_t(num_contours) * sizeof(uint16_t) + sizeof(uint16_t) > glyph_length)
+				return -3;
+			uint16_t last_contour_end = 0;
+			for (int16_t j = 0; j < num_contours; j++, current_offset += sizeof(uint16_t)) {
+				const uint16_t contour_end = read_be<uint16_t>(glyph_data + current_offset);
+				if ((j && contour_end < last_contour_end) || contour_end == 0xFFFF)
+					return -3;
+				last_contour_end = contour_end;
+			}
+			const uint32_t num_points = uint32_t(last_contour_end) + 1;
+			current_offset += sizeof(uint16_t) + read_be<uint16_t>(glyph_data + current_offset); //instructions
+			uint64_t coordinate_bytes = 0;
+			for (uint32_t j = 0; j < num_points;) {
+				if (current_offset + 1 > glyph_length)
+					return -3;
+				const uint8_t flags = uint8_t(glyph_data[current_offset++]);
+				uint32_t repeat = 1;
+				if (flags & 0x8) {
+					if (current_offset + 1 > glyph_length)
+						return -3;
+					repeat += uint8_t(glyph_data[current_offset++]);
+				}
+				const uint32_t point_bytes = ((flags & 0x2) ? 1 : ((flags & 0x10) ? 0 : 2)) + ((flags & 0x4) ? 1 : ((flags & 0x20) ? 0 : 2));
+				const uint32_t used_repeat = (repeat < num_points - j) ? repeat : num_points - j;
+				coordinate_bytes += uint64_t(point_bytes) * used_repeat;
+				j += used_repeat;
+			}
+			if (current_offset + coordinate_bytes > glyph_length)
+				return -3;
+		}
+		else if (num_contours < 0) {
+			uint16_t glyf_flags;
+			do {
+				if (current_offset + sizeof(uint16_t) * 2 > glyph_length)
+					return -3;
+				glyf_flags = read_be<uint16_t>(glyph_data + current_offset);
+				if (read_be<uint16_t>(glyph_data + current_offset + sizeof(uint16_t)) >= num_glyphs)
+					return -3;
+				current_offset += sizeof(uint16_t) * 2;
+				current_offset += (glyf_flags & ARG_1_AND_2_ARE_WORDS) ? sizeof(int16_t) * 2 : sizeof(int8_t) * 2;
+				if (glyf_flags & WE_HAVE_A_SCALE)
+					current_offset += sizeof(int16_t);
+				else if (glyf_flags & WE_HAVE_AN_X_AND_Y_SCALE)
+					current_offset += sizeof(int16_t) * 2;
+				else if (glyf_flags & WE_HAVE_A_TWO_BY_TWO)
+					current_offset += sizeof(int16_t) * 4;
+				if (current_offset > glyph_length)
+					return -3;
+			} while (glyf_flags & MORE_COMPONENTS);
+		}
+		return 0;
+	}
+
+	//Calls visit(glyph_index) for each component of a validated composite glyph record until it returns false
+	template<typename Visit>
+	bool for_each_component(const char* glyph_data, Visit visit) {
+		uint32_t current_offset = sizeof(int16_t) * 5;
+		uint16_t glyf_flags;
+		do {
+			glyf_flags = read_be<uint16_t>(glyph_data + current_offset);
+			if (!visit(read_be<uint16_t>(glyph_data + current_offset + sizeof(uint16_t))))
+				return false;
+			current_offset += sizeof(uint16_t) * 2;
+			current_offset += (glyf_flags & ARG_1_AND_2_ARE_WORDS) ? sizeof(int16_t) * 2 : sizeof(int8_t) * 2;
+			if (glyf_flags & WE_HAVE_A_SCALE)
+				current_offset += sizeof(int16_t);
+			else if (glyf_flags & WE_HAVE_AN_X_AND_Y_SCALE)
+				current_offset += sizeof(int16_t) * 2;
+			else if (glyf_flags & WE_HAVE_A_TWO_BY_TWO)
+				current_offset += sizeof(int16_t) * 4;
+		} while (glyf_flags & MORE_COMPONENTS);
+		return true;
+	}
+
+	//Nesting depth of a validated glyph, 0 for simple glyphs. Known depths are kept in depths as depth + 1
+	//The recursion stops past max_component_depth, so chains that are too deep and reference cycles return more than it
+	inline uint32_t composite_depth(const char* glyf, const std::vector<uint32_t>& glyph_offsets, uint16_t glyph_index, uint32_t level,
+		std::vector<uint8_t>& depths) {
+		if (depths[glyph_index])
+			return depths[glyph_index] - 1u;
+		if (level > max_component_depth)
+			return max_component_depth + 1;
+		uint32_t depth = 0;
+		const char* glyph_data = glyf + glyph_offsets[glyph_index];
+		if (glyph_offsets[glyph_index + 1] != glyph_offsets[glyph_index] && read_be<int16_t>(glyph_data) < 0) {
+			for_each_component(glyph_data, [&](uint16_t component) {
+				depth = std::max(depth, composite_depth(glyf, glyph_offsets, component, level + 1, depths) + 1);
+				return depth <= max_component_depth;
+			});
+		}
+		if (depth <= max_component_depth)
+			depths[glyph_index] = uint8_t(depth + 1);
+		return depth;
+	}
+
+	//Outline tables of a face, faces of a collection usually share them
+	struct GlyphTablesKey {
+		uint32_t glyf_offset;
+		uint32_t glyf_length;
+		uint32_t loca_offset;
+		uint32_t loca_length;
+		uint32_t num_glyphs;
+		int16_t index_to_loc_format;
+
+		bool operator==(const GlyphTablesKey& other) const {
+			return glyf_offset == other.glyf_offset && glyf_length == other.glyf_length && loca_offset == other.loca_offset && loca_length == other.loca_length &&
+				num_glyphs == other.num_glyphs && index_to_loc_format == other.index_to_loc_format;
+		}
+	};
+
+	//loca has to be monotonic and stay inside glyf, with validate_glyphs every glyph record is walked
+	inline int8_t validate_glyph_tables(const char* data, const TableEntry& loca_entry, const TableEntry& glyf_entry, uint32_t num_glyphs, int16_t index_to_loc_format, bool validate_glyphs) {
+		const uint32_t loca_entry_size = index_to_loc_format == 0 ? sizeof(uint16_t) : sizeof(uint32_t);
+		if (uint64_t(num_glyphs + 1) * loca_entry_size > loca_entry.length)
+			return -3;
+		std::vector<uint32_t> glyph_offsets(num_glyphs + 1);
+		for (uint32_t i = 0; i <= num_glyphs; i++) {
+			if (loca_entry_size == sizeof(uint16_t))
+				glyph_offsets[i] = uint32_t(read_be<uint16_t>(data + loca_entry.offsetPos + i * sizeof(uint16_t))) << 1;
+			else
+				glyph_offsets[i] = read_be<uint32_t>(data + loca_entry.offsetPos + i * sizeof(uint32_t));
+			if ((i && glyph_offsets[i] < glyph_offsets[i - 1]) || glyph_offsets[i] > glyf_entry.length)
+				return -3;
+		}
+		if (!validate_glyphs)
+			return 0;
+
+		//glyf, walk each glyph record to make sure it fits inside its loca range
+		for (uint32_t i = 0; i < num_glyphs; i++) {
+			if (validate_glyph(data + glyf_entry.offsetPos + glyph_offsets[i], glyph_offsets[i + 1] - glyph_offsets[i], num_glyphs))
+				return -3;
+		}
+		//Composites are decoded recursively, deeper nesting than max_component_depth is rejected before it can exhaust the stack
+		std::vector<uint8_t> depths(num_glyphs, 0);
+		for (uint32_t i = 0; i < num_glyphs; i++) {
+			if (composite_depth(data + glyf_entry.offsetPos, glyph_offsets, uint16_t(i), 0, depths) > max_component_depth)
+				return -3;
+		}
+		return 0;
+	}
+
+	//validate_data, the glyph records are skipped for a glyf table that has not fully arrived
+	//Outline tables listed in validated_glyph_tables are not checked again, the ones of a valid face are added
+	int8_t validate_font(const char* data, size_t length, uint32_t face_index, bool validate_glyphs, std::vector<GlyphTablesKey>* validated_glyph_tables = nullptr);
+}
+
+int8_t TTFFontParser::validate_data(const char* data, size_t length, uint32_t face_index) {
+	return validate_font(data, length, face_index, true);
+}
+
+int8_t TTFFontParser::validate_font(const char* data, size_t length, uint32_t face_index, bool validate_glyphs, std::vector<GlyphTablesKey>* validated_glyph_tables) {
+	uint32_t directory_offset;
+	if (!get_face_offset(data, length, face_index, directory_offset))
+		return length < TTFHeader::Layout::size ? -3 : -1;
+	TableDirectory tables;
+	int8_t error = tables.parse(data, length, directory_offset);
+	if (error)
+		return error;
+	auto find_table = [&tables](uint32_t tag, uint32_t min_length) -> const TableEntry* {
+		const TableEntry* table_entry = tables.find(tag);
+		if (!table_entry || table_entry->length < min_length)
+			return nullptr;
+		return table_entry;
+	};
+
+	const TableEntry* head_entry = find_table(tag_head, HeadTable::Layout::size);
+	const TableEntry* maxp_entry = find_table(tag_maxp, MaximumProfile::Layout::size);
+	const TableEntry* hhea_entry = find_table(tag_hhea, HHEATable::Layout::size);
+	const TableEntry* loca_entry = find_table(tag_loca, 0);
+	const TableEntry* glyf_entry = find_table(tag_glyf, 0);
+	const TableEntry* hmtx_entry = find_table(tag_hmtx, 0);
+	const TableEntry* cmap_entry = find_table(tag_cmap, sizeof(uint16_t) * 2);
+	if (!head_entry || !maxp_entry || !hhea_entry || !loca_entry || !glyf_entry || !hmtx_entry || !cmap_entry)
+		return -2;
+	HeadTable head_table;
+	head_table.parse(data, head_entry->offsetPos);
+	MaximumProfile max_profile;
+	max_profile.parse(data, maxp_entry->offsetPos);
+	HHEATable hhea_table;
+	hhea_table.parse(data, hhea_entry->offsetPos);
+	const uint32_t num_glyphs = max_profile.numGlyphs;
+
+	//hmtx
+	if (hhea_table.numberOfHMetrics > num_glyphs)
+		return -3;
+	if (uint64_t(hhea_table.numberOfHMetrics) * sizeof(uint32_t) + uint64_t(num_glyphs - hhea_table.numberOfHMetrics) * sizeof(int16_t) > hmtx_entry->length)
+		return -3;
+
+	//loca and glyf
+	const GlyphTablesKey glyph_tables = { glyf_entry->offsetPos, glyf_entry->length, loca_entry->offsetPos, loca_entry->length, num_glyphs, head_table.indexToLocFormat };
+	const bool glyph_tables_validated = validated_glyph_tables &&
+		std::find(validated_glyph_tables->begin(), validated_glyph_tables->end(), glyph_tables) != validated_glyph_tables->end();
+	if (!glyph_tables_validated) {
+		error = validate_glyph_tables(data, *loca_entry, *glyf_entry, num_glyphs, head_table.indexToLocFormat, validate_glyphs);
+		if (error)
+			return error;
+	}
+
+	//cmap, every subtable the parser may pick
+	const char* cmap_data = data + cmap_entry->offsetPos;
+	const uint16_t cmap_num_tables = read_be<uint16_t>(cmap_data + sizeof(uint16_t));
+	if (sizeof(uint16_t) * 2 + uint64_t(cmap_num_tables) * (sizeof(uint16_t) * 2 + sizeof(uint32_t)) > cmap_entry->length)
+		return -3;
+	for (uint16_t i = 0; i < cmap_num_tables; i++) {
+		const char* encoding_record = cmap_data + sizeof(uint16_t) * 2 + i * (sizeof(uint16_t) * 2 + sizeof(uint32_t));
+		const uint16_t platformID = read_be<uint16_t>(encoding_record);
+		const uint16_t encodingID = read_be<uint16_t>(encoding_record + sizeof(uint16_t));
+		const uint32_t subtable_offset = read_be<uint32_t>(encoding_record + sizeof(uint16_t) * 2);
+		if (!(platformID == 0 || (platformID == 3 && (encodingID == 1 || encodingID == 10))))
+			continue;
+		if (uint64_t(subtable_offset) + sizeof(uint16_t) > cmap_entry->length)
+			return -3;
+		const char* subtable = cmap_data + subtable_offset;
+		const uint64_t subtable_available = cmap_entry->length - subtable_offset;
+		const uint16_t format = read_be<uint16_t>(subtable);
+		if (format == 4) {
+			if (sizeof(uint16_t) * 7 > subtable_available)
+				return -3;
+			const uint32_t seg_count = read_be<uint16_t>(subtable + sizeof(uint16_t) * 3) >> 1;
+			const uint64_t end_count_offset = sizeof(uint16_t) * 7;
+			const uint64_t start_count_offset = end_count_offset + seg_count * sizeof(uint16_t) + sizeof(uint16_t);
+			const uint64_t id_range_offset_offset = start_count_offset + seg_count * sizeof(uint16_t) * 2;
+			if (id_range_offset_offset + seg_count * sizeof(uint16_t) > subtable_available)
+				return -3;
+			for (uint32_t j = 0; j < seg_count; j++) {
+				const uint16_t end_count = read_be<uint16_t>(subtable + end_count_offset + j * sizeof(uint16_t));
+				const uint16_t start_count = read_be<uint16_t>(subtable + start_count_offset + j * sizeof(uint16_t));
+				const uint16_t id_range_offset = read_be<uint16_t>(subtable + id_range_offset_offset + j * sizeof(uint16_t));
+				if (id_range_offset == 0 || start_count > end_count)
+					continue;
+				const uint64_t last_glyph_address = id_range_offset_offset + j * sizeof(uint16_t) + id_range_offset + 2 * uint64_t(end_count - start_count);
+				if (last_glyph_address + sizeof(uint16_t) > subtable_available)
+					return -3;
+			}
+		}
+		else if (format == 12 || format == 13) {
+			if (sizeof(uint16_t) * 2 + sizeof(uint32_t) * 3 > subtable_available)
+				return -3;
+			const uint32_t num_groups = read_be<uint32_t>(subtable + sizeof(uint16_t) * 2 + sizeof(uint32_t) * 2);
+			if (sizeof(uint16_t) * 2 + sizeof(uint32_t) * 3 + uint64_t(num_groups) * sizeof(uint32_t) * 3 > subtable_available)
+				return -3;
+		}
+		else if (format == 14) {
+			if (sizeof(uint16_t) + sizeof(uint32_t) * 2 > subtable_available)
+				return -3;
+			const uint32_t num_selectors = read_be<uint32_t>(subtable + sizeof(uint16_t) + sizeof(uint32_t));
+			if (sizeof(uint16_t) + sizeof(uint32_t) * 2 + uint64_t(num_selectors) * 11 > subtable_available)
+				return -3;
+			for (uint32_t j = 0; j < num_selectors; j++) {
+				const char* selector_record = subtable + sizeof(uint16_t) + sizeof(uint32_t) * 2 + j * 11;
+				const uint32_t default_offset = read_be<uint32_t>(selector_record + 3);
+				const uint32_t non_default_offset = read_be<uint32_t>(selector_record + 3 + sizeof(uint32_t));
+				if (default_offset) {
+					if (uint64_t(default_offset) + sizeof(uint32_t) > subtable_available)
+						return -3;
+					const uint32_t num_ranges = read_be<uint32_t>(subtable + default_offset);
+					if (uint64_t(default_offset) + sizeof(uint32_t) + uint64_t(num_ranges) * 4 > subtable_available)
+						return -3;
+				}
+				if (non_default_offset) {
+					if (uint64_t(non_default_offset) + sizeof(uint32_t) > subtable_available)
+						return -3;
+					const uint32_t num_mappings = read_be<uint32_t>(subtable + non_default_offset);
+					if (uint64_t(non_default_offset) + sizeof(uint32_t) + uint64_t(num_mappings) * 5 > subtable_available)
+						return -3;
+				}
+			}
+		}
+	}
+
+	//name
+	if (const TableEntry* name_table_entry = tables.find(tag_name)) {
+		const TableEntry& name_entry = *name_table_entry;
+		if (name_entry.length < sizeof(uint16_t) * 3)
+			return -3;
+		const char* name_data = data + name_entry.offsetPos;
+		const uint16_t count = read_be<uint16_t>(name_data + sizeof(uint16_t));
+		const uint16_t string_offset = read_be<uint16_t>(name_data + sizeof(uint16_t) * 2);
+		if (sizeof(uint16_t) * 3 + uint64_t(count) * NameValue::Layout::size > name_entry.length)
+			return -3;
+		for (uint16_t i = 0; i < count; i++) {
+			NameValue name_value;
+			name_value.parse(name_data, uint32_t(sizeof(uint16_t) * 3 + i * NameValue::Layout::size));
+			if (uint64_t(string_offset) + name_value.offset_value + name_value.length > name_entry.length)
+				return -3;
+		}
+	}
+
+	//kern, subtables are walked the same way the parser does
+	if (const TableEntry* kern_table_entry = tables.find(tag_kern)) {
+		const TableEntry& kern_entry = *kern_table_entry;
+		if (kern_entry.length < sizeof(uint16_t) * 2)
+			return -3;
+		const char* kern_data = data + kern_entry.offsetPos;
+		const uint16_t num_kern_subtables = read_be<uint16_t>(kern_data + sizeof(uint16_t));
+		uint64_t kern_start_offset = sizeof(uint16_t) * 2;
+		uint16_t kern_length = 0;
+		for (uint16_t i = 0; i < num_kern_subtables; i++) {
+			kern_start_offset += kern_length;
+			if (kern_start_offset + sizeof(uint16_t) * 3 > kern_entry.length)
+				return -3;
+			const uint16_t kern_version = read_be<uint16_t>(kern_data + kern_start_offset);
+			kern_length = read_be<uint16_t>(kern_data + kern_start_offset + sizeof(uint16_t));
+			if (kern_version != 0)
+				continue;
+			if (kern_start_offset + sizeof(uint16_t) * 7 > kern_entry.length)
+				return -3;
+			const uint16_t num_kern_pairs = read_be<uint16_t>(kern_data + kern_start_offset + sizeof(uint16_t) * 3);
+			if (kern_start_offset + sizeof(uint16_t) * 7 + uint64_t(num_kern_pairs) * sizeof(uint16_t) * 3 > kern_entry.length)
+				return -3;
+		}
+	}
+
+	if (validated_glyph_tables && validate_glyphs && !glyph_tables_validated)
+		validated_glyph_tables->push_back(glyph_tables);
+	return 0;
+}
+
+int8_t TTFFontParser::FontFace::open(const char* _data, size_t length) {
+	int8_t error = validate_data(_data, length, options.face_index);
+	if (!error && options.verify_checksums)
+		error = verify_checksums(_data, length, options.face_index);
+	if (error)
+		return error;
+	return open(_data);
+}
+
+/*
+* Pick the widest unicode cmap subtable (format 12 or 13, otherwise format 4) and the variation sequences (format 14)
+*/
+bool TTFFontParser::CharacterMap::parse(const char* data, uint32_t cmap_offset, uint16_t num_glyphs) {
+	clear();
+	uint16_t cmap_num_tables;
+	get2b(&cmap_num_tables, data + cmap_offset + sizeof(uint16_t)); //Skip version
+
+	uint32_t best_subtable_offset = 0, variation_subtable_offset = 0;
+	uint16_t best_format = 0;
+	int best_priority = 0;
+	for (uint16_t i = 0; i < cmap_num_tables; i++) {
+		const uint32_t encoding_record_offset = cmap_offset + sizeof(uint16_t) * 2 + i * (sizeof(uint16_t) * 2 + sizeof(uint32_t));
+		uint16_t platformID, encodingID, format;
+		uint32_t cmap_subtable_offset;
+		get2b(&platformID, data + encoding_record_offset);
+		get2b(&encodingID, data + encoding_record_offset + sizeof(uint16_t));
+		get4b(&cmap_subtable_offset, data + encoding_record_offset + sizeof(uint16_t) * 2);
+		cmap_subtable_offset += cmap_offset;
+
+		const bool unicode_bmp = (platformID == 0 && encodingID <= 3) || (platformID == 3 && encodingID == 1);
+		const bool unicode_full = (platformID == 0 && (encodingID == 4 || encodingID == 6)) || (platformID == 3 && encodingID == 10);
+		if (platformID == 0 && encodingID == 5) {
+			get2b(&format, data + cmap_subtable_offset);
+			if (format == 14)
+				variation_subtable_offset = cmap_subtable_offset;
+			continue;
+		}
+		if (!unicode_bmp && !unicode_full) //unsupported encoding
+			continue;
+
+		get2b(&format, data + cmap_subtable_offset);
+		int priority = 0;
+		if (format == 12)
+			priority = 3;
+		else if (format == 13)
+			priority = 2;
+		else if (format == 4)
+			priority = 1;
+		if (priority > best_priority) {
+			best_priority = priority;
+			best_format = format;
+			best_subtable_offset = cmap_subtable_offset;
+		}
+	}
+
+	if (best_format == 4)
+		parse_format_4(data, best_subtable_offset);
+	else if (best_format == 12)
+		parse_format_12(data, best_subtable_offset, RANGE_SEQUENTIAL);
+	else if (best_format == 13)
+		parse_format_12(data, best_subtable_offset, RANGE_CONSTANT);
+	if (variation_subtable_offset)
+		parse_format_14(data, variation_subtable_offset);
+	finalize(num_glyphs);
+	return best_priority != 0;
+}
+
+void TTFFontParser::CharacterMap::parse_format_4(const char* data, uint32_t cmap_subtable_offset) {
+	uint16_t segCountX2;
+	get2b(&segCountX2, data + cmap_subtable_offset + sizeof(uint16_t) * 3); //Skip format, length and language
+	cmap_subtable_offset += sizeof(uint16_t) * 7; //Skip segCountX2, searchRange, entrySelector and rangeShift
+
+	const uint32_t segCount = segCountX2 >> 1;
+	const uint32_t end_count_offset = cmap_subtable_offset;
+	const uint32_t start_count_offset = end_count_offset + sizeof(uint16_t) * segCount + sizeof(uint16_t);
+	const uint32_t id_delta_offset = start_count_offset + sizeof(uint16_t) * segCount;
+	const uint32_t id_range_offset_offset = id_delta_offset + sizeof(uint16_t) * segCount;
+	ranges.reserve(segCount + 1);
+	for (uint32_t j = 0; j < segCount; j++) {
+		uint16_t endCount, startCount, idRangeOffset;
+		int16_t idDelta;
+		get2b(&endCount, data + end_count_offset + j * sizeof(uint16_t));
+		get2b(&startCount, data + start_count_offset + j * sizeof(uint16_t));
+		get2b(&idDelta, data + id_delta_offset + j * sizeof(uint16_t));
+		get2b(&idRangeOffset, data + id_range_offset_offset + j * sizeof(uint16_t));
+		if (startCount > endCount)
+			continue;
+		if (idRangeOffset == 0) {
+			//glyph indices wrap around at 65536, split the segment where it does
+			const uint32_t first_glyph = uint16_t(startCount + idDelta);
+			const uint32_t wrap_character = startCount + (0x10000 - first_glyph);
+			if (wrap_character <= endCount) {
+				ranges.push_back({ startCount, wrap_character - 1, first_glyph, RANGE_SEQUENTIAL });
+				ranges.push_back({ wrap_character, endCount, 0, RANGE_SEQUENTIAL });
+			}
+			else
+				ranges.push_back({ startCount, endCount, first_glyph, RANGE_SEQUENTIAL });
+		}
+		else {
+			const uint32_t glyph_address_offset = id_range_offset_offset + j * sizeof(uint16_t) + idRangeOffset; //idRangeOffset_ptr
+			ranges.push_back({ startCount, endCount, uint32_t(glyph_ids.size()), RANGE_ARRAY });
+			for (uint32_t k = startCount; k <= endCount; k++) {
+				uint16_t glyph_map_value;
+				get2b(&glyph_map_value, data + glyph_address_offset + 2 * (k - startCount));
+				glyph_ids.push_back(glyph_map_value ? uint16_t(glyph_map_value + idDelta) : 0);
+			}
+		}
+	}
+}
+
+void TTFFontParser::CharacterMap::parse_format_12(const char* data, uint32_t cmap_subtable_offset, uint32_t type) {
+	uint32_t num_groups;
+	get4b(&num_groups, data + cmap_subtable_offset + sizeof(uint16_t) * 2 + sizeof(uint32_t) * 2); //Skip format, reserved, length and language
+	uint32_t group_offset = cmap_subtable_offset + sizeof(uint16_t) * 2 + sizeof(uint32_t) * 3;
+	ranges.reserve(num_groups);
+	for (uint32_t j = 0; j < num_groups; j++, group_offset += sizeof(uint32_t) * 3) {
+		CharacterRange range;
+		get4b(&range.start, data + group_offset);
+		get4b(&range.end, data + group_offset + sizeof(uint32_t));
+		get4b(&range.glyph_index, data + group_offset + sizeof(uint32_t) * 2);
+		range.type = type;
+		if (range.start > range.end || range.start >= 0x110000)
+			continue;
+		if (range.end >= 0x110000)
+			range.end = 0x10FFFF;
+		ranges.push_back(range);
+	}
+}
+
+void TTFFontParser::CharacterMap::parse_format_14(const char* data, uint32_t cmap_subtable_offset) {
+	auto get3b = [data](uint32_t offset) -> uint32_t {
+		return (uint32_t(uint8_t(data[offset])) << 16) | (uint32_t(uint8_t(data[offset + 1])) << 8) | uint32_t(uint8_t(data[offset + 2]));
+	};
+	uint32_t num_selectors;
+	get4b(&num_selectors, data + cmap_subtable_offset + sizeof(uint16_t) + sizeof(uint32_t)); //Skip format and length
+	uint32_t record_offset = cmap_subtable_offset + sizeof(uint16_t) + sizeof(uint32_t) * 2;
+	variation_selectors.resize(num_selectors);
+	for (uint32_t j = 0; j < num_selectors; j++, record_offset += 11) {
+		VariationSelector& variation_selector = variation_selectors[j];
+		uint32_t default_offset, non_default_offset;
+		variation_selector.selector = get3b(record_offset);
+		get4b(&default_offset, data + record_offset + 3);
+		get4b(&non_default_offset, data + record_offset + 3 + sizeof(uint32_t));
+		if (default_offset) {
+			uint32_t num_ranges;
+			get4b(&num_ranges, data + cmap_subtable_offset + default_offset);
+			variation_selector.default_ranges.resize(num_ranges);
+			for (uint32_t k = 0; k < num_ranges; k++) {
+				const uint32_t range_offset = cmap_subtable_offset + default_offset + sizeof(uint32_t) + k * sizeof(uint32_t);
+				variation_selector.default_ranges[k].start = get3b(range_offset);
+				variation_selector.default_ranges[k].end = variation_selector.default_ranges[k].start + uint8_t(data[range_offset + 3]);
+			}
+		}
+		if (non_default_offset) {
+			uint32_t num_mappings;
+			get4b(&num_mappings, data + cmap_subtable_offset + non_default_offset);
+			variation_selector.mappings.resize(num_mappings);
+			for (uint32_t k = 0; k < num_mappings; k++) {
+				const uint32_t mapping_offset = cmap_subtable_offset + non_default_offset + sizeof(uint32_t) + k * 5;
+				variation_selector.mappings[k].character = get3b(mapping_offset);
+				get2b(&variation_selector.mappings[k].glyph_index, data + mapping_offset + 3);
+			}
+		}
+	}
+	std::sort(variation_selectors.begin(), variation_selectors.end(), [](const VariationSelector& a, const VariationSelector& b) { return a.selector < b.selector; });
+}
+
+void TTFFontParser::CharacterMap::finalize(uint16_t num_glyphs) {
+	std::sort(ranges.begin(), ranges.end(), [](const CharacterRange& a, const CharacterRange& b) { return a.start < b.start; });
+
+	page_ranges.resize(num_pages + 1);
+	uint32_t range_index = 0;
+	for (uint32_t page = 0; page <= num_pages; page++) {
+		while (range_index < ranges.size() && ranges[range_index].end < (page << page_bits))
+			range_index++;
+		page_ranges[page] = range_index;
+	}
+
+	//Reverse map, the last character mapped to a glyph wins
+	characters.assign(num_glyphs, 0);
+	for (const CharacterRange& range : ranges) {
+		if (range.type == RANGE_CONSTANT) {
+			if (range.glyph_index && range.glyph_index < num_glyphs)
+				characters[range.glyph_index] = range.end;
+		}
+		else if (range.type == RANGE_SEQUENTIAL) {
+			if (range.glyph_index >= num_glyphs)
+				continue;
+			const uint32_t count = std::min(range.end - range.start, num_glyphs - 1 - range.glyph_index) + 1;
+			for (uint32_t k = (range.glyph_index == 0) ? 1 : 0; k < count; k++)
+				characters[range.glyph_index + k] = range.start + k;
+		}
+		else {
+			for (uint32_t k = 0; k <= range.end - range.start; k++) {
+				const uint16_t glyph_index = glyph_ids[range.glyph_index + k];
+				if (glyph_index && glyph_index < num_glyphs)
+					characters[glyph_index] = range.start + k;
+			}
+		}
+	}
+}
+
+uint16_t TTFFontParser::CharacterMap::get_glyph_index(uint32_t character, uint32_t variation_selector) const {
+	auto selector_find = std::lower_bound(variation_selectors.begin(), variation_selectors.end(), variation_selector,
+		[](const VariationSelector& a, uint32_t b) { return a.selector < b; });
+	if (selector_find == variation_selectors.end() || selector_find->selector != variation_selector)
+		return 0;
+	auto mapping_find = std::lower_bound(selector_find->mappings.begin(), selector_find->mappings.end(), character,
+		[](const VariationMapping& a, uint32_t b) { return a.character < b; });
+	if (mapping_find != selector_find->mappings.end() && mapping_find->character == character)
+		return (mapping_find->glyph_index < characters.size()) ? mapping_find->glyph_index : 0;
+	auto range_find = std::lower_bound(selector_find->default_ranges.begin(), selector_find->default_ranges.end(), character,
+		[](const UnicodeRange& a, uint32_t b) { return a.end < b; });
+	if (range_find != selector_find->default_ranges.end() && range_find->start <= character)
+		return get_glyph_index(character);
+	return 0;
+}
+
+int8_t TTFFontParser::FontFace::open(const char* _data) {
+	return open(_data, std::vector<std::shared_ptr<GlyphStore>>());
+}
+
+/*
+* Read the table directory, loca and cmap of a ttf font, glyphs are decoded later on demand
+*/
+int8_t TTFFontParser::FontFace::open(const char* _data, const std::vector<std::shared_ptr<GlyphStore>>& shared_stores) {
+	if (file && file->data != _data)
+		file.reset();
+	data = _data;
+	tables.clear();
+	character_map.clear();
+	glyph_store.reset();
+
+	//The directory of a collection face is found through the ttcf header, the data is not bounds checked here
+	uint32_t directory_offset = 0;
+	if (!get_face_offset(data, SIZE_MAX, options.face_index, directory_offset))
+		return -1;
+	tables.parse(data, SIZE_MAX, directory_offset);
+	const TableEntry* head_table_entry = tables.find(tag_head);
+	if (!head_table_entry)
+		return -2;
+	head_table.parse(data, head_table_entry->offsetPos);
+	const TableEntry* maxp_table_entry = tables.find(tag_maxp);
+	if (!maxp_table_entry)
+		return -2;
+	max_profile.parse(data, maxp_table_entry->offsetPos);
+
+	const TableEntry* cmap_table_entry = tables.find(tag_cmap);
+	if (!cmap_table_entry)
+		return -2;
+	if (!character_map.parse(data, cmap_table_entry->offsetPos, max_profile.numGlyphs))
+		TTFDEBUG_PRINT("ttf-parser: No valid cmap table found\n");
+
+	const TableEntry* hhea_table_entry = tables.find(tag_hhea);
+	if (!hhea_table_entry)
+		return -2;
+	hhea_table.parse(data, hhea_table_entry->offsetPos);
+
+	const TableEntry* name_table_entry = tables.find(tag_name);
+	name_table = NameTableView();
+	if (name_table_entry)
+		name_table.open(data, name_table_entry->offsetPos, name_table_entry->length);
+
+	const TableEntry* loca_table_entry = tables.find(tag_loca);
+	const TableEntry* glyf_table_entry = tables.find(tag_glyf);
+	const TableEntry* hmtx_table_entry = tables.find(tag_hmtx);
+	if (!loca_table_entry || !glyf_table_entry || !hmtx_table_entry)
+		return -2;
+
+	if (!max_profile.numGlyphs)
+		return -1;
+
+	meta_data.unitsPerEm = head_table.unitsPerEm;
+	meta_data.Ascender = hhea_table.Ascender;
+	meta_data.Descender = hhea_table.Descender;
+	meta_data.LineGap = hhea_table.LineGap;
+
+	//Faces of a collection often point at the same outline tables, their glyphs are decoded once
+	auto store = std::make_shared<GlyphStore>(options.memory_resource ? options.memory_resource : std::pmr::get_default_resource());
+	store->data = data;
+	store->glyf_offset = glyf_table_entry->offsetPos;
+	store->loca_offset = loca_table_entry->offsetPos;
+	store->hmtx_offset = hmtx_table_entry->offsetPos;
+	store->num_glyphs = max_profile.numGlyphs;
+	store->number_of_h_metrics = hhea_table.numberOfHMetrics;
+	store->index_to_loc_format = head_table.indexToLocFormat;
+	store->flat_geometry = options.flat_geometry;
+	for (const std::shared_ptr<GlyphStore>& shared_store : shared_stores) {
+		if (shared_store && shared_store->same_tables(*store)) {
+			glyph_store = shared_store;
+			return 0;
+		}
+	}
+
+	std::vector<uint32_t>& glyph_offsets = store->glyph_offsets;
+	glyph_offsets.resize(max_profile.numGlyphs + 1);
+	if (head_table.indexToLocFormat == 0) {
+		uint32_t byte_offset = store->loca_offset;
+		for (uint32_t i = 0; i <= max_profile.numGlyphs; i++, byte_offset += sizeof(uint16_t)) {
+			uint16_t short_offset;
+			get2b(&short_offset, data + byte_offset);
+			glyph_offsets[i] = uint32_t(short_offset) << 1;
+		}
+	}
+	else {
+		uint32_t byte_offset = store->loca_offset;
+		for (uint32_t i = 0; i <= max_profile.numGlyphs; i++, byte_offset += sizeof(uint32_t)) {
+			get4b(&glyph_offsets[i], data + byte_offset);
+		}
+	}
+	store->glyph_state.assign(max_profile.numGlyphs, 0);
+	glyph_store = std::move(store);
+
+	return 0;
+}
+
+int8_t TTFFontParser::FontCollection::open(const char* data, size_t length, const ParseOptions& options) {
+	if (file && file->data != data)
+		file.reset();
+	faces.clear();
+	glyph_stores.clear();
+	const uint32_t num_faces = get_num_faces(data, length);
+	if (!num_faces)
+		return -3;
+	faces.resize(num_faces);
+	//Shared glyf and loca tables are validated with the first face that uses them
+	std::vector<GlyphTablesKey> validated_glyph_tables;
+	for (uint32_t i = 0; i < num_faces; i++) {
+		FontFace& face = faces[i];
+		face.options = options;
+		face.options.face_index = i;
+		int8_t error = validate_font(data, length, i, true, &validated_glyph_tables);
+		if (!error && options.verify_checksums)
+			error = verify_checksums(data, length, i);
+		if (!error)
+			error = face.open(data, glyph_stores);
+		if (error) {
+			faces.clear();
+			glyph_stores.clear();
+			return error;
+		}
+		if (std::find(glyph_stores.begin(), glyph_stores.end(), face.glyph_store) == glyph_stores.end())
+			glyph_stores.push_back(face.glyph_store);
+		face.file = file;
+	}
+	return 0;
+}
+
+int8_t TTFFontParser::FontCollection::open_file(const char* file_name, const ParseOptions& options) {
+	auto file_buffer = std::make_shared<FontFileBuffer>();
+	if (file_buffer->open(file_name))
+		return -1;
+	file = std::move(file_buffer);
+	return open(file->data, file->length, options);
+}
+
+void TTFFontParser::StreamingParser::reset(size_t _expected_length) {
+	buffer.clear();
+	received = 0;
+	expected_length = _expected_length;
+	font_length = 0;
+	tables.clear();
+	directory_ready = false;
+	face_ready = false;
+	name_ready = false;
+	glyphs_arrived = 0;
+	error = 0;
+	if (expected_length)
+		buffer.reserve(expected_length);
+}
+
+/*
+* Bytes are collected until the directory is complete, then the buffer is sized once to the end of the last table so the face can point into it
+*/
+int8_t TTFFontParser::StreamingParser::push(const char* chunk, size_t length) {
+	if (error)
+		return error;
+	if (!directory_ready) {
+		buffer.insert(buffer.end(), chunk, chunk + length);
+		received += length;
+		error = read_directory();
+	}
+	else {
+		if (received < buffer.size())
+			memcpy(buffer.data() + received, chunk, std::min(length, buffer.size() - received));
+		received += length;
+	}
+	if (!error && directory_ready)
+		error = update();
+	return error;
+}
+
+int8_t TTFFontParser::StreamingParser::read_directory() {
+	const char* data = buffer.data();
+	if (received < CollectionHeader::Layout::size)
+		return 0;
+	if (options.face_index >= get_num_faces(data, SIZE_MAX))
+		return -1;
+	uint32_t directory_offset;
+	if (!get_face_offset(data, received, options.face_index, directory_offset)) //offsets of the collection did not arrive yet
+		return 0;
+	if (expected_length && uint64_t(directory_offset) + TTFHeader::Layout::size > expected_length)
+		return -3;
+	if (uint64_t(directory_offset) + TTFHeader::Layout::size > received)
+		return 0;
+	const uint16_t num_tables = read_be<uint16_t>(data + directory_offset + sizeof(uint32_t));
+	const uint64_t directory_end = uint64_t(directory_offset) + TTFHeader::Layout::size + uint64_t(num_tables) * TableEntry::Layout::size;
+	if (expected_length && directory_end > expected_length)
+		return -3;
+	if (directory_end > received)
+		return 0;
+
+	uint64_t tables_end = directory_end;
+	for (uint32_t ptr = uint32_t(directory_offset + TTFHeader::Layout::size); ptr < directory_end;) {
+		TableEntry table_entry;
+		ptr = table_entry.parse(data, ptr);
+		tables_end = std::max<uint64_t>(tables_end, uint64_t(table_entry.offsetPos) + table_entry.length);
+	}
+	if ((expected_length && tables_end > expected_length) || tables_end > UINT32_MAX)
+		return -3;
+	tables.parse(data, SIZE_MAX, directory_offset);
+	if (!tables.find(tag_head) || !tables.find(tag_maxp) || !tables.find(tag_hhea) || !tables.find(tag_hmtx) ||
+		!tables.find(tag_cmap) || !tables.find(tag_loca) || !tables.find(tag_glyf))
+		return -2;
+	font_length = size_t(tables_end);
+	buffer.resize(std::max(font_length, buffer.size()));
+	directory_ready = true;
+	return 0;
+}
+
+bool TTFFontParser::StreamingParser::has_table(uint32_t tag) const {
+	const TableEntry* table_entry = tables.find(tag);
+	return directory_ready && table_entry && uint64_t(table_entry->offsetPos) + table_entry->length <= received;
+}
+
+/*
+* Opens the face once its tables are there, glyph records are then validated in index order as their range completes
+*/
+int8_t TTFFontParser::StreamingParser::update() {
+	if (!face_ready) {
+		if (!has_table(tag_head) || !has_table(tag_maxp) || !has_table(tag_hhea) || !has_table(tag_hmtx) || !has_table(tag_cmap) || !has_table(tag_loca))
+			return 0;
+		int8_t face_error = validate_font(buffer.data(), buffer.size(), options.face_index, false);
+		if (face_error)
+			return face_error;
+		face.options = options;
+		face_error = face.open(buffer.data());
+		if (face_error)
+			return face_error;
+		face_ready = true;
+	}
+	if (!name_ready && has_table(tag_name)) { //opened over zeros by the face before it arrived
+		const TableEntry* name_entry = tables.find(tag_name);
+		face.name_table.open(buffer.data(), name_entry->offsetPos, name_entry->length);
+		name_ready = true;
+	}
+	const GlyphStore& store = *face.glyph_store;
+	while (glyphs_arrived < store.num_glyphs && uint64_t(store.glyf_offset) + store.glyph_offsets[glyphs_arrived + 1] <= received) {
+		const uint32_t glyph_offset = store.glyph_offsets[glyphs_arrived];
+		if (validate_glyph(buffer.data() + store.glyf_offset + glyph_offset, store.glyph_offsets[glyphs_arrived + 1] - glyph_offset, store.num_glyphs))
+			return -3;
+		glyphs_arrived++;
+	}
+	return 0;
+}
+
+namespace TTFFontParser {
+	//Components are checked recursively, glyphs nested deeper than max_component_depth (or in a cycle) are never reported, the face would reject them
+	inline bool glyph_has_arrived(const StreamingParser& parser, uint16_t glyph_index, uint32_t depth) {
+		if (glyph_index >= parser.glyphs_arrived)
+			return false;
+		const GlyphStore& store = *parser.face.glyph_store;
+		const uint32_t glyph_offset = store.glyph_offsets[glyph_index];
+		if (store.glyph_offsets[glyph_index + 1] == glyph_offset)
+			return true;
+		const char* glyph_data = parser.buffer.data() + store.glyf_offset + glyph_offset;
+		if (read_be<int16_t>(glyph_data) >= 0)
+			return true;
+		if (depth == max_component_depth)
+			return false;
+		return for_each_component(glyph_data, [&](uint16_t component) {
+			return glyph_has_arrived(parser, component, depth + 1);
+		});
+	}
+}
+
+bool TTFFontParser::StreamingParser::has_glyph(uint16_t glyph_index) const {
+	return face_ready && glyph_has_arrived(*this, glyph_index, 0);
+}
+
+const TTFFontParser::Glyph* TTFFontParser::StreamingParser::get_glyph_by_index(uint16_t glyph_index) {
+	return has_glyph(glyph_index) ? face.get_glyph_by_index(glyph_index) : nullptr;
+}
+
+const TTFFontParser::Glyph* TTFFontParser::StreamingParser::get_glyph(uint32_t character) {
+	if (!face_ready)
+		return nullptr;
+	uint16_t glyph_index;
+	if (!face.get_glyph_index(character, glyph_index))
+		return nullptr;
+	return get_glyph_by_index(glyph_index);
+}
+
+int8_t TTFFontParser::StreamingParser::finish(FontData* font_data) const {
+	if (error)
+		return error;
+	if (!complete())
+		return -1;
+	return parse_data(buffer.data(), buffer.size(), font_data, options);
+}
+
+bool TTFFontParser::FontFace::get_glyph_index(uint32_t character, uint16_t& glyph_index) const {
+	glyph_index = character_map.get_glyph_index(character);
+	return glyph_index != 0;
+}
+
+uint32_t TTFFontParser::FontFace::get_character(uint16_t glyph_index) const {
+	return character_map.get_character(glyph_index);
+}
+
+const TTFFontParser::Glyph* TTFFontParser::FontFace::get_glyph(uint32_t character) {
+	uint16_t glyph_index;
+	if (!get_glyph_index(character, glyph_index))
+		return nullptr;
+	return get_glyph_by_index(glyph_index);
+}
+
+const TTFFontParser::Glyph* TTFFontParser::FontFace::get_glyph_by_index(uint16_t glyph_index) {
+	if (!glyph_store || glyph_index >= max_profile.numGlyphs)
+		return nullptr;
+	GlyphStore& store = *glyph_store;
+	if (store.glyph_state[glyph_index] == 2)
+		return &store.glyph_cache.find(glyph_index)->second;
+	if (store.glyph_state[glyph_index] == 1) {
+		TTFDEBUG_PRINT("ttf-parser: recursive composite glyph %d\n", glyph_index);
+		return nullptr;
+	}
+	store.glyph_state[glyph_index] = 1;
+	Glyph& glyph = store.glyph_cache[glyph_index]; //node based, stays valid while components are inserted
+	parse_glyph(glyph_index, glyph);
+	store.glyph_state[glyph_index] = 2;
+	return &glyph;
+}
+
+int8_t TTFFontParser::FontFace::parse_glyph_header(uint16_t i, Glyph& current_glyph, uint32_t& current_offset) const {
+	const GlyphStore& store = *glyph_store;
+	current_glyph.glyph_index = i;
+	current_glyph.character = get_character(i);
+
+	if (i < hhea_table.numberOfHMetrics) {
+		get2b(&current_glyph.advance_width, data + store.hmtx_offset + i * sizeof(uint32_t));
+		get2b(&current_glyph.left_side_bearing, data + store.hmtx_offset + i * sizeof(uint32_t) + sizeof(uint16_t));
+	}
+	else if (hhea_table.numberOfHMetrics) {
+		get2b(&current_glyph.advance_width, data + store.hmtx_offset + (hhea_table.numberOfHMetrics - 1) * sizeof(uint32_t));
+		get2b(&current_glyph.left_side_bearing, data + store.hmtx_offset + hhea_table.numberOfHMetrics * sizeof(uint32_t) + (i - hhea_table.numberOfHMetrics) * sizeof(int16_t));
+	}
+
+	if (store.glyph_offsets[i] == store.glyph_offsets[i + 1]) //no outline
+		return -1;
+
+	current_offset = store.glyf_offset + store.glyph_offsets[i];
+
+	get2b(&current_glyph.num_contours, data + current_offset); current_offset += sizeof(int16_t);
+	get2b(&current_glyph.bounding_box[0], data + current_offset); current_offset += sizeof(int16_t);
+	get2b(&current_glyph.bounding_box[1], data + current_offset); current_offset += sizeof(int16_t);
+	get2b(&current_glyph.bounding_box[2], data + current_offset); current_offset += sizeof(int16_t);
+	get2b(&current_glyph.bounding_box[3], data + current_offset); current_offset += sizeof(int16_t);
+
+	current_glyph.glyph_center.x = (current_glyph.bounding_box[0] + current_glyph.bounding_box[2]) / 2.0f;
+	current_glyph.glyph_center.y = (current_glyph.bounding_box[1] + current_glyph.bounding_box[3]) / 2.0f;
+	return 0;
+}
+
+void TTFFontParser::FontFace::parse_simple_glyph(uint32_t current_offset, uint32_t outline_end, GeometrySink& sink, GlyphDecodeScratch& glyph_scratch) const {
+	Glyph& current_glyph = sink.glyph;
+	std::vector<uint16_t>& contour_end = glyph_scratch.contour_end;
+	contour_end.resize(current_glyph.num_contours);
+	if (!sink.flat_geometry)
+		current_glyph.path_list.reserve(current_glyph.num_contours);
+	for (uint16_t j = 0; j < current_glyph.num_contours; j++) {
+		get2b(&contour_end[j], data + current_offset); current_offset += sizeof(uint16_t);
+	}
+
+	//Skip instructions
+	uint16_t num_instructions;
+	get2b(&num_instructions, data + current_offset); current_offset += sizeof(uint16_t);
+	current_offset += sizeof(uint8_t) * num_instructions;
+
+	uint16_t num_points = contour_end[current_glyph.num_contours - 1] + 1;
+	std::vector<uint8_t>& flags = glyph_scratch.flags;
+	std::vector<int16_t>& x_coordinates = glyph_scratch.x_coordinates;
+	std::vector<int16_t>& y_coordinates = glyph_scratch.y_coordinates;
+	std::vector<int16_v2>& points = glyph_scratch.points;
+	flags.resize(num_points);
+	x_coordinates.resize(num_points);
+	y_coordinates.resize(num_points);
+	points.resize(num_points);
+	const char* src = data + current_offset;
+	const char* src_end = data + outline_end;
+	src = decode_glyph_flags(src, src_end, flags.data(), num_points);
+	src = decode_glyph_coordinates(src, src_end, flags.data(), num_points, X_SHORT_VECTOR, X_IS_SAME_OR_POSITIVE_X_SHORT_VECTOR, x_coordinates.data());
+	decode_glyph_coordinates(src, src_end, flags.data(), num_points, Y_SHORT_VECTOR, Y_IS_SAME_OR_POSITIVE_Y_SHORT_VECTOR, y_coordinates.data());
+	for (uint16_t j = 0; j < num_points; j++)
+		points[j] = { x_coordinates[j], y_coordinates[j] };
+
+	//Generate contours
+	for (uint16_t j = 0; j < current_glyph.num_contours; j++) {
+		const uint16_t contour_start = j ? contour_end[j - 1] + 1 : 0;
+		const uint16_t num_points_per_contour = contour_end[j] + 1 - contour_start;
+		sink.begin_path(num_points_per_contour); //a contour has at most one curve per point
+		if (!num_points_per_contour)
+			continue;
+		float_v2 prev_point = { 0.0f, 0.0f };
+		const uint16_t point_index_0 = contour_start;
+		const bool off_curve_0 = !(flags[point_index_0] & ON_CURVE_POINT);
+		//If the first point is off curve
+		if (off_curve_0) {
+			const uint16_t point_index_m1 = contour_start + num_points_per_contour - 1;
+			const bool off_curve_m1 = !(flags[point_index_m1] & ON_CURVE_POINT);
+			const int16_v2& p0 = points[point_index_0];
+			const int16_v2& pm1 = points[point_index_m1];
+			if (off_curve_m1) {
+				prev_point.x = (p0.x + pm1.x) / 2.0f;
+				prev_point.y = (p0.y + pm1.y) / 2.0f;
+			}
+			else {
+				prev_point.x = pm1.x;
+				prev_point.y = pm1.y;
+			}
+		}
+		for (uint16_t k = 0; k < num_points_per_contour; k++) {
+			const uint16_t point_index0 = contour_start + k % num_points_per_contour;
+			const uint16_t point_index1 = contour_start + (k + 1) % num_points_per_contour;
+			const bool off_curve0 = !(flags[point_index0] & ON_CURVE_POINT);
+			const bool off_curve1 = !(flags[point_index1] & ON_CURVE_POINT);
+			const int16_v2& p0 = points[point_index0];
+			const int16_v2& p1 = points[point_index1];
+			Curve curve;
+			if (off_curve0) {
+				curve.p0.x = prev_point.x;
+				curve.p0.y = prev_point.y;
+				curve.p1.x = p0.x;
+				curve.p1.y = p0.y;
+				if (off_curve1) {
+					curve.c.x = (p0.x + p1.x) / 2.0f;
+					curve.c.y = (p0.y + p1.y) / 2.0f;
+
+					prev_point = curve.c;
+				}
+				else {
+					curve.c.x = p1.x;
+					curve.c.y = p1.y;
+					//No change to prev_point
+				}
+			}
+			else if (!off_curve1) {
+				curve.p0.x = p0.x;
+				curve.p0.y = p0.y;
+				curve.p1.x = p1.x;
+				curve.p1.y = p1.y;
+				curve.c.x = current_glyph.glyph_center.x;
+				curve.c.y = current_glyph.glyph_center.y;
+
+				prev_point.x = p0.x;
+				prev_point.y = p0.y;
+			}
+			else {
+				const uint16_t point_index2 = contour_start + (k + 2) % num_points_per_contour;
+				const bool off_curve2 = !(flags[point_index2] & ON_CURVE_POINT);
+				const int16_v2& p2 = points[point_index2];
+				if (off_curve2) {
+					curve.p0.x = p0.x;
+					curve.p0.y = p0.y;
+					curve.p1.x = p1.x;
+					curve.p1.y = p1.y;
+					curve.c.x = (p1.x + p2.x) / 2.0f;
+					curve.c.y = (p1.y + p2.y) / 2.0f;
+
+					prev_point = curve.c;
+
+				}
+				else {
+					curve.p0.x = p0.x;
+					curve.p0.y = p0.y;
+					curve.p1.x = p1.x;
+					curve.p1.y = p1.y;
+					curve.c.x = p2.x;
+					curve.c.y = p2.y;
+
+					prev_point.x = p0.x;
+					prev_point.y = p0.y;
+				}
+			}
+			if (off_curve0 || off_curve1) {
+				curve.is_curve = true;
+				if (!off_curve0)
+					k++;
+			}
+			else
+				curve.is_curve = false;
+			sink.add_curve(curve);
+		}
+	}
+}
+
+/*
+* Decode simple glyphs ahead on worker threads, each worker has its own scratch and flat buffers
+* Glyphs are handed out in blocks from a shared counter, so workers stay busy when outline sizes are uneven
+*/
+void TTFFontParser::FontFace::decode_simple_glyphs(uint32_t num_threads) {
+	if (!glyph_store)
+		return;
+	GlyphStore& store = *glyph_store;
+	const uint32_t glyph_count = max_profile.numGlyphs;
+	const uint32_t block_size = 64;
+#ifdef TTF_FONT_PARSER_THREADS
+	if (num_threads == 0)
+		num_threads = std::thread::hardware_concurrency();
+#else
+	num_threads = 1;
+#endif
+	num_threads = std::max<uint32_t>(1, std::min<uint32_t>(num_threads, (glyph_count + block_size - 1) / block_size));
+
+	store.decoded_glyphs.clear();
+	store.decoded_glyphs.resize(glyph_count);
+	store.decoded_batch.assign(glyph_count, 0);
+	store.decode_batches.clear();
+	store.decode_batches.resize(num_threads);
+
+	std::atomic<uint32_t> next_glyph(0);
+	auto worker = [this, &store, &next_glyph, glyph_count, block_size](uint32_t batch_index) {
+		GlyphStore::DecodeBatch& batch = store.decode_batches[batch_index];
+		GlyphDecodeScratch worker_scratch;
+		for (uint32_t first = next_glyph.fetch_add(block_size); first < glyph_count; first = next_glyph.fetch_add(block_size)) {
+			if (options.cancel && options.cancel->load(std::memory_order_relaxed))
+				break;
+			const uint32_t last = std::min(first + block_size, glyph_count);
+			for (uint32_t i = first; i < last; i++) {
+				if (store.glyph_state[i] != 0) //already in the cache
+					continue;
+				Glyph& glyph = store.decoded_glyphs[i];
+				GeometrySink sink = { glyph, batch.path_ranges, batch.curves, options.flat_geometry };
+				glyph.first_path = uint32_t(batch.path_ranges.size());
+				uint32_t outline_offset;
+				if (parse_glyph_header(uint16_t(i), glyph, outline_offset) == 0) {
+					if (glyph.num_contours <= 0) //composite, resolved by parse_glyph after its components
+						continue;
+					parse_simple_glyph(outline_offset, store.glyf_offset + store.glyph_offsets[i + 1], sink, worker_scratch);
+				}
+				store.decoded_batch[i] = uint16_t(batch_index + 1);
+			}
+		}
+	};
+#ifdef TTF_FONT_PARSER_THREADS
+	std::vector<std::thread> workers;
+	workers.reserve(num_threads - 1);
+	for (uint32_t t = 1; t < num_threads; t++)
+		workers.emplace_back(worker, t);
+	worker(0);
+	for (std::thread& worker_thread : workers)
+		worker_thread.join();
+#else
+	worker(0);
+#endif
+}
+
+/*
+* Decode the metrics and outline of a single glyph, components of composite glyphs are loaded through the cache
+*/
+int8_t TTFFontParser::FontFace::parse_glyph(uint16_t i, Glyph& current_glyph) {
+	GlyphStore& store = *glyph_store;
+	std::pmr::vector<PathRange>& path_ranges = store.path_ranges;
+	std::pmr::vector<Curve>& curves = store.curves;
+	const bool flat_geometry = options.flat_geometry;
+	if (i < store.decoded_batch.size() && store.decoded_batch[i]) {
+		const GlyphStore::DecodeBatch& batch = store.decode_batches[store.decoded_batch[i] - 1];
+		current_glyph = std::move(store.decoded_glyphs[i]);
+		if (flat_geometry) {
+			const uint32_t batch_first_path = current_glyph.first_path;
+			current_glyph.first_path = uint32_t(path_ranges.size());
+			if (current_glyph.num_paths) {
+				const PathRange& last_path = batch.path_ranges[batch_first_path + current_glyph.num_paths - 1];
+				const uint32_t batch_first_curve = batch.path_ranges[batch_first_path].first_curve;
+				const uint32_t first_curve = uint32_t(curves.size());
+				for (uint32_t k = 0; k < current_glyph.num_paths; k++) {
+					const PathRange& batch_path = batch.path_ranges[batch_first_path + k];
+					path_ranges.push_back({ first_curve + (batch_path.first_curve - batch_first_curve), batch_path.num_curves });
+				}
+				curves.insert(curves.end(), batch.curves.begin() + batch_first_curve, batch.curves.begin() + last_path.first_curve + last_path.num_curves);
+			}
+		}
+		return 0;
+	}
+
+	GeometrySink sink = { current_glyph, path_ranges, curves, flat_geometry };
+	current_glyph.first_path = uint32_t(path_ranges.size());
+	uint32_t current_offset;
+	int8_t error = parse_glyph_header(i, current_glyph, current_offset);
+	if (error)
+		return error;
+
+	if (current_glyph.num_contours > 0) //Simple glyph
+		parse_simple_glyph(current_offset, store.glyf_offset + store.glyph_offsets[i + 1], sink, scratch);
+
+	else { //Composite glyph
+		std::vector<GlyphComponent>& components = scratch.components;
+		const size_t first_component = components.size();
+		uint16_t glyf_flags, glyphIndex;
+		do {
+			get2b(&glyf_flags, data + current_offset); current_offset += sizeof(uint16_t);
+			get2b(&glyphIndex, data + current_offset); current_offset += sizeof(uint16_t);
+
+			int16_t glyf_args1, glyf_args2;
+			int8_t glyf_args1_u8, glyf_args2_u8;
+			bool is_word = false;
+			if (glyf_flags & ARG_1_AND_2_ARE_WORDS) {
+				get2b(&glyf_args1, data + current_offset); current_offset += sizeof(int16_t);
+				get2b(&glyf_args2, data + current_offset); current_offset += sizeof(int16_t);
+				is_word = true;
+			}
+			else {
+				get1b(&glyf_args1_u8, data + current_offset); current_offset += sizeof(int8_t);
+				get1b(&glyf_args2_u8, data + current_offset); current_offset += sizeof(int8_t);
+			}
+
+			GlyphComponent component = { glyphIndex, { 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f } };
+			float* composite_glyph_element_transformation = component.transformation;
+
+			if (glyf_flags & WE_HAVE_A_SCALE) {
+				int16_t xy_value;
+				get2b(&xy_value, data + current_offset); current_offset += sizeof(int16_t);
+				composite_glyph_element_transformation[0] = to_2_14_float(xy_value);
+				composite_glyph_element_transformation[3] = to_2_14_float(xy_value);
+			}
+			else if (glyf_flags & WE_HAVE_AN_X_AND_Y_SCALE) {
+				int16_t xy_values[2];
+				get2b(&xy_values[0], data + current_offset); current_offset += sizeof(int16_t);
+				get2b(&xy_values[1], data + current_offset); current_offset += sizeof(int16_t);
+				composite_glyph_element_transformation[0] = to_2_14_float(xy_values[0]);
+				composite_glyph_element_transformation[3] = to_2_14_float(xy_values[1]);
+			}
+			else if (glyf_flags & WE_HAVE_A_TWO_BY_TWO) {
+				int16_t xy_values[4];
+				get2b(&xy_values[0], data + current_offset); current_offset += sizeof(int16_t);
+				get2b(&xy_values[1], data + current_offset); current_offset += sizeof(int16_t);
+				get2b(&xy_values[2], data + current_offset); current_offset += sizeof(int16_t);
+				get2b(&xy_values[3], data + current_offset); current_offset += sizeof(int16_t);
+				composite_glyph_element_transformation[0] = to_2_14_float(xy_values[0]);
+				composite_glyph_element_transformation[1] = to_2_14_float(xy_values[1]);
+				composite_glyph_element_transformation[2] = to_2_14_float(xy_values[2]);
+				composite_glyph_element_transformation[3] = to_2_14_float(xy_values[3]);
+			}
+
+			bool matched_points = false;
+			if (glyf_flags & ARGS_ARE_XY_VALUES) {
+				composite_glyph_element_transformation[4] = float(is_word ? glyf_args1 : glyf_args1_u8);
+				composite_glyph_element_transformation[5] = float(is_word ? glyf_args2 : glyf_args2_u8);
+				if (glyf_flags & SCALED_COMPONENT_OFFSET) {
+					composite_glyph_element_transformation[4] *= composite_glyph_element_transformation[0];
+					composite_glyph_element_transformation[5] *= composite_glyph_element_transformation[3];
+				}
+			}
+			else {
+				matched_points = true;
+			}
+
+			if (matched_points) {
+				TTFDEBUG_PRINT("ttf-parser: unsupported matched points in ttf composite glyph\n");
+				continue;
+			}
+
+			components.push_back(component);
+		} while (glyf_flags & MORE_COMPONENTS);
+		const size_t end_component = components.size();
+		if (options.instance_composites) {
+			current_glyph.components.assign(components.begin() + first_component, components.end());
+			components.resize(first_component);
+			return 0;
+		}
+
+		//Load every component before copying, so the paths of this glyph stay contiguous in flat geometry
+		for (size_t j = first_component; j < end_component; j++) {
+			if (get_glyph_by_index(components[j].glyph_index) == nullptr)
+				TTFDEBUG_PRINT("ttf-parser: bad glyph index %d in composite glyph\n", components[j].glyph_index);
+		}
+		current_glyph.first_path = uint32_t(path_ranges.size());
+		for (size_t j = first_component; j < end_component; j++) {
+			const GlyphComponent component = components[j];
+			if (component.glyph_index >= max_profile.numGlyphs || store.glyph_state[component.glyph_index] != 2)
+				continue;
+			const Glyph& composite_glyph_element = store.glyph_cache.find(component.glyph_index)->second;
+
+			if (flat_geometry) {
+				for (uint32_t k = 0; k < composite_glyph_element.num_paths; k++) {
+					const PathRange component_path = path_ranges[composite_glyph_element.first_path + k];
+					sink.begin_path();
+					for (uint32_t l = 0; l < component_path.num_curves; l++)
+						sink.add_curve(transform_curve(curves[component_path.first_curve + l], component.transformation));
+				}
+			}
+			else {
+				for (const Path& component_path : composite_glyph_element.path_list) {
+					Path& new_path = current_glyph.path_list.emplace_back(); //allocated from the resource of the glyph
+					new_path.geometry.reserve(component_path.geometry.size());
+					for (const Curve& component_curve : component_path.geometry)
+						new_path.geometry.emplace_back(transform_curve(component_curve, component.transformation));
+				}
+			}
+		}
+		components.resize(first_component);
+	}
+	return 0;
+}
+
+int8_t TTFFontParser::parse_data(const char* data, size_t length, TTFFontParser::FontData* font_data, const TTFFontParser::ParseOptions& options) {
+	int8_t error = validate_data(data, length, options.face_index);
+	if (!error && options.verify_checksums)
+		error = verify_checksums(data, length, options.face_index);
+	if (error)
+		return error;
+	return parse_data(data, font_data, options);
+}
+
+int8_t TTFFontParser::parse_data(const char* data, TTFFontParser::FontData* font_data) {
+	return parse_data(data, font_data, ParseOptions());
+}
+
+/*
+* Parse a ttf font and output glyph data into FontData
+*/
+int8_t TTFFontParser::parse_data(const char* data, TTFFontParser::FontData* font_data, const TTFFontParser::ParseOptions& options) {
+	FontFace face;
+	face.options = options;
+	face.options.memory_resource = font_data->resource(); //glyphs then move into font_data without copies
+	int8_t error = face.open(data);
+	if (error)
+		return error;
+
+	const TableEntry* name_table_entry = face.tables.find(tag_name);
+	if (!name_table_entry)
+		return -2;
+	NameTable name_table;
+	name_table.parse(data, name_table_entry->offsetPos, font_data->name_table);
+
+	//iterate through all name table platform, encoding and language combinations
+	for (const auto& name_table_iterator : font_data->name_table) {
+		FontData::FontNameData font_name_data;
+		font_name_data.from_uint64(name_table_iterator.first);
+		font_name_data.font_family = name_table_iterator.second[1];
+		font_name_data.font_style = name_table_iterator.second[2];
+		font_data->font_names.emplace_back(font_name_data);
+	}
+
+#ifdef TTF_FONT_PARSER_THREADS
+	//Simple glyphs are decoded in parallel, the loop below then only resolves composite glyphs
+	const uint32_t num_threads = options.num_threads ? options.num_threads : std::thread::hardware_concurrency();
+	if (num_threads > 1)
+		face.decode_simple_glyphs(num_threads);
+#endif
+	for (uint32_t i = 0; i < face.max_profile.numGlyphs; i++) {
+		if (options.cancel && i % 64 == 0 && options.cancel->load(std::memory_order_relaxed))
+			return -4;
+		face.get_glyph_by_index(uint16_t(i));
+	}
+	//Components of instanced composites stay reachable by glyph index
+	std::vector<uint8_t> is_component;
+	if (options.instance_composites) {
+		is_component.assign(face.max_profile.numGlyphs, 0);
+		for (const auto& glyph : face.glyph_store->glyph_cache) {
+			for (const GlyphComponent& component : glyph.second.components) {
+				if (component.glyph_index < is_component.size())
+					is_component[component.glyph_index] = 1;
+			}
+		}
+	}
+	//Unmapped glyphs share character 0, the first one (.notdef) is kept
+	for (uint16_t i = 0; i < face.max_profile.numGlyphs; i++) {
+		Glyph& glyph = face.glyph_store->glyph_cache.find(i)->second;
+		if (glyph.character == 0 && font_data->glyphs.count(0)) {
+			if (!is_component.empty() && is_component[i])
+				font_data->component_glyphs[i] = std::move(glyph);
+			continue;
+		}
+		font_data->glyphs[glyph.character] = std::move(glyph);
+	}
+	font_data->path_ranges = std::move(face.glyph_store->path_ranges);
+	font_data->curves = std::move(face.glyph_store->curves);
+
+	//Kearning table, GPOS pair adjustments take precedence over the legacy kern table
+	const TableEntry* gpos_table_entry = face.tables.find(tag_gpos);
+	const TableEntry* kern_table_entry = face.tables.find(tag_kern);
+	bool has_gpos_kerning = false;
+	if (gpos_table_entry)
+		has_gpos_kerning = font_data->kearning_table.parse_gpos(data, gpos_table_entry->offsetPos, gpos_table_entry->length, face.max_profile.numGlyphs);
+	if (!has_gpos_kerning && kern_table_entry)
+		font_data->kearning_table.parse(data, kern_table_entry->offsetPos, face.max_profile.numGlyphs);
+	font_data->has_kearning_table = !font_data->kearning_table.empty();
+
+	font_data->meta_data = face.meta_data;
+	font_data->character_map = std::move(face.character_map);
+
+	return 0;
+}
+
+const TTFFontParser::Glyph* TTFFontParser::FontData::get_glyph_by_index(uint16_t glyph_index) const {
+	const auto glyph = glyphs.find(character_map.get_character(glyph_index));
+	if (glyph != glyphs.end() && uint16_t(glyph->second.glyph_index) == glyph_index)
+		return &glyph->second;
+	const auto component_glyph = component_glyphs.find(glyph_index);
+	return component_glyph != component_glyphs.end() ? &component_glyph->second : nullptr;
+}
+
+namespace TTFFontParser {
+	struct FlatPathSink {
+		std::vector<PathRange>& path_ranges;
+		std::vector<Curve>& curves;
+
+		void begin_path() {
+			path_ranges.push_back({ uint32_t(curves.size()), 0 });
+		}
+		void add_curve(const Curve& curve) {
+			curves.push_back(curve);
+			path_ranges.back().num_curves++;
+		}
+	};
+	struct PathListSink {
+		std::pmr::vector<Path>& path_list;
+
+		void begin_path() {
+			path_list.emplace_back();
+		}
+		void add_curve(const Curve& curve) {
+			path_list.back().geometry.push_back(curve);
+		}
+	};
+
+	//transforms[0] belongs to the outermost component, the innermost transformation is applied first like when the paths are copied at parse time
+	//The geometry is indexed after every lookup, as a lazy lookup may append to it
+	template<typename GlyphLookup, typename Sink>
+	void expand_glyph_paths(const Glyph& glyph, const std::pmr::vector<PathRange>& path_ranges, const std::pmr::vector<Curve>& curves, GlyphLookup& lookup,
+		const float** transforms, uint32_t depth, Sink& sink) {
+		if (!glyph.components.empty()) {
+			if (depth == max_component_depth)
+				return;
+			for (const GlyphComponent& component : glyph.components) {
+				const Glyph* component_glyph = lookup(component.glyph_index);
+				if (!component_glyph)
+					continue;
+				transforms[depth] = component.transformation;
+				expand_glyph_paths(*component_glyph, path_ranges, curves, lookup, transforms, depth + 1, sink);
+			}
+			return;
+		}
+		auto add_curve = [&](Curve curve) {
+			for (uint32_t k = depth; k-- > 0;)
+				curve = transform_curve(curve, transforms[k]);
+			sink.add_curve(curve);
+		};
+		if (!glyph.path_list.empty()) {
+			for (const Path& path : glyph.path_list) {
+				sink.begin_path();
+				for (const Curve& curve : path.geometry)
+					add_curve(curve);
+			}
+		}
+		else {
+			for (uint32_t k = 0; k < glyph.num_paths; k++) {
+				const PathRange path = path_ranges[glyph.first_path + k];
+				sink.begin_path();
+				for (uint32_t l = 0; l < path.num_curves; l++)
+					add_curve(curves[path.first_curve + l]);
+			}
+		}
+	}
+}
+
+void TTFFontParser::expand_glyph(const FontData& font_data, const Glyph& glyph, std::vector<PathRange>& path_ranges, std::vector<Curve>& curves) {
+	auto lookup = [&font_data](uint16_t glyph_index) { return font_data.get_glyph_by_index(glyph_index); };
+	const float* transforms[max_component_depth];
+	FlatPathSink sink = { path_ranges, curves };
+	expand_glyph_paths(glyph, font_data.path_ranges, font_data.curves, lookup, transforms, 0, sink);
+}
+
+void TTFFontParser::expand_glyph(const FontData& font_data, const Glyph& glyph, std::pmr::vector<Path>& path_list) {
+	auto lookup = [&font_data](uint16_t glyph_index) { return font_data.get_glyph_by_index(glyph_index); };
+	const float* transforms[max_component_depth];
+	PathListSink sink = { path_list };
+	expand_glyph_paths(glyph, font_data.path_ranges, font_data.curves, lookup, transforms, 0, sink);
+}
+
+void TTFFontParser::FontFace::expand_glyph(uint16_t glyph_index, std::vector<PathRange>& path_ranges, std::vector<Curve>& curves) {
+	const Glyph* glyph = get_glyph_by_index(glyph_index);
+	if (!glyph)
+		return;
+	auto lookup = [this](uint16_t component_index) { return get_glyph_by_index(component_index); };
+	const float* transforms[max_component_depth];
+	FlatPathSink sink = { path_ranges, curves };
+	expand_glyph_paths(*glyph, glyph_store->path_ranges, glyph_store->curves, lookup, transforms, 0, sink);
+}
+
+void TTFFontParser::FontFace::expand_glyph(uint16_t glyph_index, std::pmr::vector<Path>& path_list) {
+	const Glyph* glyph = get_glyph_by_index(glyph_index);
+	if (!glyph)
+		return;
+	auto lookup = [this](uint16_t component_index) { return get_glyph_by_index(component_index); };
+	const float* transforms[max_component_depth];
+	PathListSink sink = { path_list };
+	expand_glyph_paths(*glyph, glyph_store->path_ranges, glyph_store->curves, lookup, transforms, 0, sink);
+}
+
+int16_t TTFFontParser::get_kearning_offset(FontData* font_data, uint32_t left_glyph, uint32_t right_glyph)
+{
+	if (font_data->has_kearning_table)
+		return font_data->kearning_table.get_kerning(font_data->character_map.get_glyph_index(left_glyph), font_data->character_map.get_glyph_index(right_glyph));
+	else
+		return 0;
+}
+
+void TTFFontParser::get_kearning_offsets(const FontData* font_data, const uint16_t* glyph_indices, size_t count, int16_t* adjustments)
+{
+	if (font_data->has_kearning_table)
+		font_data->kearning_table.get_kerning(glyph_indices, count, adjustments);
+	else if (count)
+		memset(adjustments, 0, sizeof(int16_t) * count);
+}
+
+namespace TTFFontParser {
+	//Bounds the segments of one curve for degenerate tolerances
+	constexpr uint32_t max_flatten_segments = 1024;
+
+	inline uint32_t flatten_segment_count(const Curve& curve, float tolerance) {
+		if (!curve.is_curve)
+			return 1;
+		//the chord of a quadratic is at most |start - 2 * control + end| / 4 away from it, n uniform pieces divide that by n * n
+		const float dx = curve.p0.x - 2.f * curve.p1.x + curve.c.x;
+		const float dy = curve.p0.y - 2.f * curve.p1.y + curve.c.y;
+		const float segments = ceilf(sqrtf(sqrtf(dx * dx + dy * dy) / (4.f * tolerance)));
+		if (!(segments >= 1.f)) //also catches NaN
+			return 1;
+		return segments < float(max_flatten_segments) ? uint32_t(segments) : max_flatten_segments;
+	}
+
+	//Writes the points at t = k / num_segments for k = 1 ... num_segments, evaluated as (a * t + b) * t + p0
+	inline void evaluate_quadratic(const Curve& curve, uint32_t num_segments, float_v2* points) {
+		const float_v2 a = { curve.p0.x - 2.f * curve.p1.x + curve.c.x, curve.p0.y - 2.f * curve.p1.y + curve.c.y };
+		const float_v2 b = { 2.f * (curve.p1.x - curve.p0.x), 2.f * (curve.p1.y - curve.p0.y) };
+		const float step = 1.f / float(num_segments);
+		const uint32_t num_inner = num_segments - 1;
+		uint32_t k = 0;
+#ifdef TTF_FONT_PARSER_SSE4
+		const __m128 ax = _mm_set1_ps(a.x), ay = _mm_set1_ps(a.y);
+		const __m128 bx = _mm_set1_ps(b.x), by = _mm_set1_ps(b.y);
+		const __m128 p0x = _mm_set1_ps(curve.p0.x), p0y = _mm_set1_ps(curve.p0.y);
+		const __m128 lane_index = _mm_setr_ps(1.f, 2.f, 3.f, 4.f);
+		const __m128 step_v = _mm_set1_ps(step);
+		for (; k + 4 <= num_inner; k += 4) {
+			const __m128 t = _mm_mul_ps(_mm_add_ps(lane_index, _mm_set1_ps(float(k))), step_v);
+			const __m128 x = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(ax, t), bx), t), p0x);
+			const __m128 y = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(ay, t), by), t), p0y);
+			_mm_storeu_ps(&points[k].x, _mm_unpacklo_ps(x, y));
+			_mm_storeu_ps(&points[k + 2].x, _mm_unpackhi_ps(x, y));
+		}
+#endif
+		for (; k < num_inner; k++) {
+			const float t = float(k + 1) * step;
+			points[k].x = (a.x * t + b.x) * t + curve.p0.x;
+			points[k].y = (a.y * t + b.y) * t + curve.p0.y;
+		}
+		points[num_inner] = curve.c; //exact end point, the next curve starts there
+	}
+}
+
+uint32_t TTFFontParser::flatten_curves(const Curve* curves, uint32_t num_curves, float tolerance, float_v2* points, uint32_t max_points) {
+	if (!num_curves)
+		return 0;
+	uint32_t num_points = 1;
+	if (max_points)
+		points[0] = curves[0].p0;
+	for (uint32_t i = 0; i < num_curves; i++) {
+		const Curve& curve = curves[i];
+		const uint32_t num_segments = flatten_segment_count(curve, tolerance);
+		if (num_points + num_segments <= max_points) {
+			if (curve.is_curve)
+				evaluate_quadratic(curve, num_segments, points + num_points);
+			else
+				points[num_points] = curve.p1;
+		}
+		num_points += num_segments;
+	}
+	return num_points;
+}
+
+uint32_t TTFFontParser::flatten_glyph(const Glyph& glyph, const PathRange* path_ranges, const Curve* curves, float tolerance, float_v2* points, uint32_t max_points, uint32_t* contour_ends) {
+	uint32_t num_points = 0;
+	const uint32_t num_paths = glyph.path_list.empty() ? glyph.num_paths : uint32_t(glyph.path_list.size());
+	for (uint32_t i = 0; i < num_paths; i++) {
+		const Curve* path_curves;
+		uint32_t num_curves;
+		if (glyph.path_list.empty()) {
+			const PathRange& range = path_ranges[glyph.first_path + i];
+			path_curves = curves + range.first_curve;
+			num_curves = range.num_curves;
+		}
+		else {
+			path_curves = glyph.path_list[i].geometry.data();
+			num_curves = uint32_t(glyph.path_list[i].geometry.size());
+		}
+		const uint32_t remaining = max_points > num_points ? max_points - num_points : 0;
+		num_points += flatten_curves(path_curves, num_curves, tolerance, points + (remaining ? num_points : 0), remaining);
+		if (contour_ends)
+			contour_ends[i] = num_points;
+	}
+	return num_points;
+}
+
+uint32_t TTFFontParser::flatten_glyph(const FontData& font_data, const Glyph& glyph, float tolerance, float_v2* points, uint32_t max_points, uint32_t* contour_ends) {
+	return flatten_glyph(glyph, font_data.path_ranges.data(), font_data.curves.data(), tolerance, points, max_points, contour_ends);
+}
+
+namespace TTFFontParser {
+	//Polyline edge in bitmap space, e is b - a and inv_length2 is 0 for a point
+	struct SdfSegment {
+		float ax, ay, ex, ey, inv_length2;
+	};
+	//Up to sdf_run_length consecutive segments of a contour with their bounding box, skipped when every pixel of a block is closer to another edge
+	struct SdfSegmentRun {
+		uint32_t first_segment;
+		uint32_t num_segments;
+		float min_x, min_y, max_x, max_y;
+	};
+	struct SdfCrossing {
+		float x;
+		int32_t winding;
+	};
+	constexpr uint32_t sdf_run_length = 16;
+
+	//Reused by every glyph of one thread
+	struct SdfScratch {
+		std::vector<float_v2> points;
+		std::vector<uint32_t> contour_ends;
+		std::vector<SdfSegment> segments;
+		std::vector<SdfSegmentRun> runs;
+		std::vector<SdfCrossing> crossings;
+		std::vector<float> row_distance; //squared distances of one row
+	};
+
+	inline float sdf_segment_distance2(const SdfSegment& segment, float x, float y) {
+		const float dx = x - segment.ax, dy = y - segment.ay;
+		const float t = std::min(1.f, std::max(0.f, (dx * segment.ex + dy * segment.ey) * segment.inv_length2));
+		const float nx = dx - t * segment.ex, ny = dy - t * segment.ey;
+		return nx * nx + ny * ny;
+	}
+
+	void build_glyph_sdf(const Glyph& glyph, const PathRange* path_ranges, const Curve* curves, const SdfOptions& options, GlyphSdf& sdf, SdfScratch& scratch) {
+		sdf.width = sdf.height = 0;
+		sdf.left = sdf.top = 0;
+		sdf.pixels.clear();
+		const float scale = options.scale;
+		const uint32_t num_paths = glyph.path_list.empty() ? glyph.num_paths : uint32_t(glyph.path_list.size());
+		scratch.contour_ends.resize(num_paths);
+		const float tolerance = options.tolerance / scale;
+		const uint32_t num_points = flatten_glyph(glyph, path_ranges, curves, tolerance, nullptr, 0, nullptr);
+		if (num_points < 2 || !(scale > 0.f))
+			return;
+		scratch.points.resize(num_points);
+		flatten_glyph(glyph, path_ranges, curves, tolerance, scratch.points.data(), num_points, scratch.contour_ends.data());
+
+		float min_x = scratch.points[0].x, max_x = min_x, min_y = scratch.points[0].y, max_y = min_y;
+		for (const float_v2& point : scratch.points) {
+			min_x = std::min(min_x, point.x);
+			max_x = std::max(max_x, point.x);
+			min_y = std::min(min_y, point.y);
+			max_y = std::max(max_y, point.y);
+		}
+		const float spread = std::max(options.spread, 1e-3f);
+		sdf.left = int32_t(floorf(min_x * scale - spread));
+		sdf.top = int32_t(ceilf(max_y * scale + spread));
+		sdf.width = uint32_t(int32_t(ceilf(max_x * scale + spread)) - sdf.left);
+		sdf.height = uint32_t(sdf.top - int32_t(floorf(min_y * scale - spread)));
+		sdf.pixels.resize(size_t(sdf.width) * sdf.height);
+		//bitmap space, x right and y down from the top left corner
+		for (float_v2& point : scratch.points) {
+			point.x = point.x * scale - float(sdf.left);
+			point.y = float(sdf.top) - point.y * scale;
+		}
+
+		scratch.segments.clear();
+		scratch.runs.clear();
+		uint32_t contour_start = 0;
+		for (uint32_t i = 0; i < num_paths; i++) {
+			const uint32_t contour_end = scratch.contour_ends[i];
+			for (uint32_t j = contour_start; j + 1 < contour_end; j++) {
+				const float_v2 a = scratch.points[j], b = scratch.points[j + 1];
+				if ((j - contour_start) % sdf_run_length == 0)
+					scratch.runs.push_back({ uint32_t(scratch.segments.size()), 0, a.x, a.y, a.x, a.y });
+				SdfSegmentRun& run = scratch.runs.back();
+				run.num_segments++;
+				run.min_x = std::min(run.min_x, b.x);
+				run.max_x = std::max(run.max_x, b.x);
+				run.min_y = std::min(run.min_y, b.y);
+				run.max_y = std::max(run.max_y, b.y);
+				const float ex = b.x - a.x, ey = b.y - a.y;
+				const float length2 = ex * ex + ey * ey;
+				scratch.segments.push_back({ a.x, a.y, ex, ey, length2 > 0.f ? 1.f / length2 : 0.f });
+			}
+			contour_start = contour_end;
+		}
+
+		const float spread2 = spread * spread;
+		const float value_scale = 127.5f / spread;
+		scratch.row_distance.resize(sdf.width);
+		for (uint32_t y = 0; y < sdf.height; y++) {
+			const float py = float(y) + 0.5f;
+			//crossings of the row with the outline, for the nonzero winding of each pixel
+			scratch.crossings.clear();
+			for (const SdfSegment& segment : scratch.segments) {
+				const float by = segment.ay + segment.ey;
+				if ((segment.ay <= py) == (by <= py))
+					continue;
+				const float x = segment.ax + (py - segment.ay) * segment.ex / segment.ey;
+				scratch.crossings.push_back({ x, segment.ey > 0.f ? 1 : -1 });
+			}
+			std::sort(scratch.crossings.begin(), scratch.crossings.end(), [](const SdfCrossing& a, const SdfCrossing& b) { return a.x < b.x; });
+
+			float* row_distance = scratch.row_distance.data();
+			uint32_t x = 0;
+#ifdef TTF_FONT_PARSER_SSE4
+			const __m128 lane_offset = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			const __m128 py_v = _mm_set1_ps(py);
+			const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+			for (; x + 4 <= sdf.width; x += 4) {
+				const __m128 px_v = _mm_add_ps(_mm_set1_ps(float(x)), lane_offset);
+				__m128 best = _mm_set1_ps(spread2);
+				for (const SdfSegmentRun& run : scratch.runs) {
+					const float dx = std::max(std::max(run.min_x - (float(x) + 3.5f), (float(x) + 0.5f) - run.max_x), 0.f);
+					const float dy = std::max(std::max(run.min_y - py, py - run.max_y), 0.f);
+					const __m128 best_max = _mm_max_ps(best, _mm_shuffle_ps(best, best, _MM_SHUFFLE(1, 0, 3, 2)));
+					if (dx * dx + dy * dy >= _mm_cvtss_f32(_mm_max_ss(best_max, _mm_shuffle_ps(best_max, best_max, _MM_SHUFFLE(2, 3, 0, 1)))))
+						continue;
+					const SdfSegment* segment = scratch.segments.data() + run.first_segment;
+					for (uint32_t k = 0; k < run.num_segments; k++, segment++) {
+						const __m128 ex = _mm_set1_ps(segment->ex), ey = _mm_set1_ps(segment->ey);
+						const __m128 dx_v = _mm_sub_ps(px_v, _mm_set1_ps(segment->ax));
+						const __m128 dy_v = _mm_sub_ps(py_v, _mm_set1_ps(segment->ay));
+						__m128 t = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(dx_v, ex), _mm_mul_ps(dy_v, ey)), _mm_set1_ps(segment->inv_length2));
+						t = _mm_min_ps(one, _mm_max_ps(zero, t));
+						const __m128 nx = _mm_sub_ps(dx_v, _mm_mul_ps(t, ex));
+						const __m128 ny = _mm_sub_ps(dy_v, _mm_mul_ps(t, ey));
+						best = _mm_min_ps(best, _mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)));
+					}
+				}
+				_mm_storeu_ps(row_distance + x, best);
+			}
+#endif
+			for (; x < sdf.width; x++) {
+				const float px = float(x) + 0.5f;
+				float best = spread2;
+				for (const SdfSegmentRun& run : scratch.runs) {
+					const float dx = std::max(std::max(run.min_x - px, px - run.max_x), 0.f);
+					const float dy = std::max(std::max(run.min_y - py, py - run.max_y), 0.f);
+					if (dx * dx + dy * dy >= best)
+						continue;
+					for (uint32_t k = 0; k < run.num_segments; k++)
+						best = std::min(best, sdf_segment_distance2(scratch.segments[run.first_segment + k], px, py));
+				}
+				row_distance[x] = best;
+			}
+
+			uint8_t* row = sdf.pixels.data() + size_t(y) * sdf.width;
+			int32_t winding = 0;
+			size_t crossing = 0;
+			for (x = 0; x < sdf.width; x++) {
+				const float px = float(x) + 0.5f;
+				while (crossing < scratch.crossings.size() && scratch.crossings[crossing].x < px)
+					winding += scratch.crossings[crossing++].winding;
+				const float distance = sqrtf(row_distance[x]) * (winding ? value_scale : -value_scale);
+				row[x] = uint8_t(std::min(255.f, std::max(0.f, 128.f + distance)));
+			}
+		}
 	}
-	auto head_table_entry = table_map.find("head");
-	if (head_table_entry == table_map.end())
-		return -2;
-	HeadTable head_table;
-	ptr = head_table.parse(data, head_table_entry->second.offsetPos);
-	auto maxp_table_entry = table_map.find("maxp");
-	if (maxp_table_entry == table_map.end())
-		return -2;
-	MaximumProfile max_profile;
-	max_profile.parse(data, maxp_table_entry->second.offsetPos);
-	auto name_table_entry = table_map.find("name");
-	if (name_table_entry == table_map.end())
-		return -2;
-	NameTable name_table;
-	name_table.parse(data, name_table_entry->second.offsetPos, font_data->name_table);
+}
 
-	//iterate through all name table platform, encoding and language combinations
-	for (const auto& name_table_iterator : font_data->name_table) {
-		FontData::FontNameData font_name_data;
-		font_name_data.from_uint64(name_table_iterator.first);
-		font_name_data.font_family = name_table_iterator.second[1];
-		font_name_data.font_style = name_table_iterator.second[2];
-		font_data->font_names.emplace_back(font_name_data);
+void TTFFontParser::build_glyph_sdf(const Glyph& glyph, const PathRange* path_ranges, const Curve* curves, const SdfOptions& options, GlyphSdf& sdf) {
+	SdfScratch scratch;
+	build_glyph_sdf(glyph, path_ranges, curves, options, sdf, scratch);
+}
+
+void TTFFontParser::build_glyph_sdfs(const Glyph* const* glyphs, size_t count, const PathRange* path_ranges, const Curve* curves, const SdfOptions& options, GlyphSdf* sdfs) {
+	uint32_t num_threads = options.num_threads;
+#ifdef TTF_FONT_PARSER_THREADS
+	if (num_threads == 0)
+		num_threads = std::thread::hardware_concurrency();
+#else
+	num_threads = 1;
+#endif
+	num_threads = uint32_t(std::max<size_t>(1, std::min<size_t>(num_threads, count)));
+
+	//one glyph at a time, the cost of a glyph grows with its bitmap area
+	std::atomic<size_t> next_glyph(0);
+	auto worker = [&]() {
+		SdfScratch scratch;
+		for (size_t i = next_glyph.fetch_add(1); i < count; i = next_glyph.fetch_add(1))
+			build_glyph_sdf(*glyphs[i], path_ranges, curves, options, sdfs[i], scratch);
+	};
+#ifdef TTF_FONT_PARSER_THREADS
+	std::vector<std::thread> workers;
+	workers.reserve(num_threads - 1);
+	for (uint32_t t = 1; t < num_threads; t++)
+		workers.emplace_back(worker);
+	worker();
+	for (std::thread& worker_thread : workers)
+		worker_thread.join();
+#else
+	worker();
+#endif
+}
+
+void TTFFontParser::build_glyph_sdfs(const FontData& font_data, const Glyph* const* glyphs, size_t count, const SdfOptions& options, GlyphSdf* sdfs) {
+	size_t num_composites = 0;
+	for (size_t i = 0; i < count; i++)
+		num_composites += !glyphs[i]->components.empty();
+	if (!num_composites) {
+		build_glyph_sdfs(glyphs, count, font_data.path_ranges.data(), font_data.curves.data(), options, sdfs);
+		return;
+	}
+	//Copies of the composite glyphs hold their expanded paths in path_list, which is used instead of the flat geometry
+	std::vector<Glyph> expanded;
+	expanded.reserve(num_composites);
+	std::vector<const Glyph*> sources(glyphs, glyphs + count);
+	for (const Glyph*& glyph : sources) {
+		if (glyph->components.empty())
+			continue;
+		expanded.push_back(*glyph);
+		Glyph& expanded_glyph = expanded.back();
+		expanded_glyph.components.clear();
+		expanded_glyph.path_list.clear();
+		expanded_glyph.num_paths = 0;
+		expand_glyph(font_data, *glyph, expanded_glyph.path_list);
+		glyph = &expanded_glyph;
 	}
+	build_glyph_sdfs(sources.data(), count, font_data.path_ranges.data(), font_data.curves.data(), options, sdfs);
+}
 
-	auto loca_table_entry = table_map.find("loca");
-	if (loca_table_entry == table_map.end())
-		return -2;
-	std::vector<uint32_t> glyph_index(max_profile.numGlyphs);
-	uint32_t end_of_glyf = 0;
-	if (head_table.indexToLocFormat == 0) {
-		uint32_t byte_offset = loca_table_entry->second.offsetPos;
-		for (uint16_t i = 0; i < max_profile.numGlyphs; i++, byte_offset += sizeof(uint16_t)) {
-			get2b(&glyph_index[i], data + byte_offset);
-			glyph_index[i] = glyph_index[i] << 1;
+namespace TTFFontParser {
+	//Distance of the rasterized polylines to the curves in pixels
+	constexpr float raster_tolerance = 0.2f;
+
+	//Adds the signed area of a line to the coverage accumulation, every cell gets the area right of the line within it and the next cell the rest
+	inline void accumulate_line(float* accumulation, uint32_t width, uint32_t height, float_v2 p0, float_v2 p1) {
+		if (p0.y == p1.y)
+			return;
+		float direction = 1.f;
+		if (p0.y > p1.y) {
+			std::swap(p0, p1);
+			direction = -1.f;
 		}
-		get2b(&end_of_glyf, data + byte_offset);
-		end_of_glyf = end_of_glyf << 1;
-	}
-	else {
-		uint32_t byte_offset = loca_table_entry->second.offsetPos;
-		for (uint16_t i = 0; i < max_profile.numGlyphs; i++, byte_offset += sizeof(uint32_t)) {
-			get4b(&glyph_index[i], data + byte_offset);
+		const float dxdy = (p1.x - p0.x) / (p1.y - p0.y);
+		float x = p0.x;
+		if (p0.y < 0.f)
+			x -= p0.y * dxdy;
+		const uint32_t y_end = std::min(height, uint32_t(ceilf(p1.y)));
+		for (uint32_t y = uint32_t(std::max(0.f, p0.y)); y < y_end; y++) {
+			float* row = accumulation + size_t(y) * width;
+			const float dy = std::min(float(y + 1), p1.y) - std::max(float(y), p0.y);
+			const float x_next = x + dxdy * dy;
+			const float d = dy * direction;
+			//clamped against rounding just outside of the bitmap
+			const float x0 = std::max(std::min(x, x_next), 0.f), x1 = std::min(std::max(x, x_next), float(width - 1));
+			const float x0_floor = floorf(x0);
+			const int32_t x0i = int32_t(x0_floor);
+			const float x1_ceil = ceilf(x1);
+			const int32_t x1i = int32_t(x1_ceil);
+			if (x1i <= x0i + 1) {
+				const float xmf = 0.5f * (x + x_next) - x0_floor;
+				row[x0i] += d - d * xmf;
+				row[x0i + 1] += d * xmf;
+			}
+			else {
+				const float s = 1.f / (x1 - x0);
+				const float x0f = x0 - x0_floor;
+				const float a0 = 0.5f * s * (1.f - x0f) * (1.f - x0f);
+				const float x1f = x1 - x1_ceil + 1.f;
+				const float am = 0.5f * s * x1f * x1f;
+				row[x0i] += d * a0;
+				if (x1i == x0i + 2)
+					row[x0i + 1] += d * (1.f - a0 - am);
+				else {
+					const float a1 = s * (1.5f - x0f);
+					row[x0i + 1] += d * (a1 - a0);
+					for (int32_t xi = x0i + 2; xi < x1i - 1; xi++)
+						row[xi] += d * s;
+					const float a2 = a1 + float(x1i - x0i - 3) * s;
+					row[x1i - 1] += d * (1.f - a2 - am);
+				}
+				row[x1i] += d * am;
+			}
+			x = x_next;
 		}
-		get4b(&end_of_glyf, data + byte_offset);
 	}
+}
 
-	auto cmap_table_entry = table_map.find("cmap");
-	if (cmap_table_entry == table_map.end())
-		return -2;
-	uint32_t cmap_offset = cmap_table_entry->second.offsetPos + sizeof(uint16_t); //Skip version
-	uint16_t cmap_num_tables;
-	get2b(&cmap_num_tables, data + cmap_offset); cmap_offset += sizeof(uint16_t);
+void TTFFontParser::rasterize_glyph(const Glyph& glyph, const PathRange* path_ranges, const Curve* curves, float scale, float subpixel_x, GlyphBitmap& bitmap, RasterScratch& scratch) {
+	bitmap.width = bitmap.height = 0;
+	bitmap.left = bitmap.top = 0;
+	bitmap.pixels.clear();
+	const uint32_t num_paths = glyph.path_list.empty() ? glyph.num_paths : uint32_t(glyph.path_list.size());
+	scratch.contour_ends.resize(num_paths);
+	const float tolerance = raster_tolerance / scale;
+	const uint32_t num_points = flatten_glyph(glyph, path_ranges, curves, tolerance, nullptr, 0, nullptr);
+	if (num_points < 2 || !(scale > 0.f))
+		return;
+	scratch.points.resize(num_points);
+	flatten_glyph(glyph, path_ranges, curves, tolerance, scratch.points.data(), num_points, scratch.contour_ends.data());
 
-	std::map<uint32_t, uint16_t> glyph_map;
-	std::map<uint16_t, uint32_t> glyph_reverse_map;
+	float min_x = scratch.points[0].x, max_x = min_x, min_y = scratch.points[0].y, max_y = min_y;
+	for (const float_v2& point : scratch.points) {
+		min_x = std::min(min_x, point.x);
+		max_x = std::max(max_x, point.x);
+		min_y = std::min(min_y, point.y);
+		max_y = std::max(max_y, point.y);
+	}
+	bitmap.left = int32_t(floorf(min_x * scale + subpixel_x));
+	bitmap.top = int32_t(ceilf(max_y * scale));
+	//one extra column takes the area right of lines that end on the right edge
+	bitmap.width = uint32_t(int32_t(ceilf(max_x * scale + subpixel_x)) - bitmap.left + 1);
+	bitmap.height = uint32_t(bitmap.top - int32_t(floorf(min_y * scale)));
+	const size_t num_pixels = size_t(bitmap.width) * bitmap.height;
+	scratch.accumulation.assign(num_pixels + 4, 0.f);
 
-	bool valid_cmap_table = false;
-	for (uint16_t i = 0; i < cmap_num_tables; i++) {
-		uint16_t platformID, encodingID;
-		uint32_t cmap_subtable_offset;
-		get2b(&platformID, data + cmap_offset); cmap_offset += sizeof(uint16_t);
-		get2b(&encodingID, data + cmap_offset); cmap_offset += sizeof(uint16_t);
-		get4b(&cmap_subtable_offset, data + cmap_offset); cmap_offset += sizeof(uint32_t);
+	uint32_t contour_start = 0;
+	for (uint32_t i = 0; i < num_paths; i++) {
+		const uint32_t contour_end = scratch.contour_ends[i];
+		float_v2 previous = { 0.f, 0.f };
+		for (uint32_t j = contour_start; j < contour_end; j++) {
+			const float_v2 point = { scratch.points[j].x * scale + subpixel_x - float(bitmap.left), float(bitmap.top) - scratch.points[j].y * scale };
+			if (j != contour_start)
+				accumulate_line(scratch.accumulation.data(), bitmap.width, bitmap.height, previous, point);
+			previous = point;
+		}
+		contour_start = contour_end;
+	}
 
-		if (!((platformID == 0 && encodingID == 3) || (platformID == 3 && encodingID == 1))) //unsupported encoding
-			continue;
+	//coverage is the running sum of the accumulated areas over the whole bitmap
+	bitmap.pixels.resize(num_pixels);
+	const float* accumulation = scratch.accumulation.data();
+	uint8_t* pixels = bitmap.pixels.data();
+	size_t i = 0;
+	float sum = 0.f;
+#ifdef TTF_FONT_PARSER_SSE4
+	__m128 offset = _mm_setzero_ps();
+	const __m128 sign_mask = _mm_set1_ps(-0.f);
+	const __m128 one = _mm_set1_ps(1.f), max_value = _mm_set1_ps(255.f), half = _mm_set1_ps(0.5f);
+	for (; i + 4 <= num_pixels; i += 4) {
+		__m128 x = _mm_loadu_ps(accumulation + i);
+		x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+		x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+		x = _mm_add_ps(x, offset);
+		const __m128 coverage = _mm_min_ps(_mm_andnot_ps(sign_mask, x), one);
+		const __m128i values = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(coverage, max_value), half));
+		const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(values, values), _mm_setzero_si128());
+		const uint32_t packed = uint32_t(_mm_cvtsi128_si32(bytes));
+		memcpy(pixels + i, &packed, sizeof(packed));
+		offset = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	sum = _mm_cvtss_f32(offset);
+#endif
+	for (; i < num_pixels; i++) {
+		sum += accumulation[i];
+		pixels[i] = uint8_t(std::min(fabsf(sum), 1.f) * 255.f + 0.5f);
+	}
+}
 
-		cmap_subtable_offset += cmap_table_entry->second.offsetPos;
-		uint16_t format, length;
-		get2b(&format, data + cmap_subtable_offset); cmap_subtable_offset += sizeof(uint16_t);
-		get2b(&length, data + cmap_subtable_offset); cmap_subtable_offset += sizeof(uint16_t);
+void TTFFontParser::AtlasPacker::reset(uint32_t atlas_width, uint32_t atlas_height) {
+	width = atlas_width;
+	height = atlas_height;
+	skyline.clear();
+	if (width)
+		skyline.push_back({ 0, 0, width });
+}
 
-		if (format != 4)
+bool TTFFontParser::AtlasPacker::pack(uint32_t rect_width, uint32_t rect_height, uint32_t& x, uint32_t& y) {
+	if (!rect_width || !rect_height) {
+		x = y = 0;
+		return true;
+	}
+	size_t best_index = skyline.size();
+	uint32_t best_bottom = UINT32_MAX, best_top = 0, best_span = UINT32_MAX;
+	for (size_t i = 0; i < skyline.size() && skyline[i].x + rect_width <= width; i++) {
+		//the rectangle rests on the highest node it spans
+		uint32_t top = 0;
+		uint32_t remaining = rect_width;
+		for (size_t j = i; remaining; j++) {
+			top = std::max(top, skyline[j].y);
+			remaining -= std::min(remaining, skyline[j].width);
+		}
+		if (top + rect_height > height)
 			continue;
+		if (top + rect_height < best_bottom || (top + rect_height == best_bottom && skyline[i].width < best_span)) {
+			best_index = i;
+			best_bottom = top + rect_height;
+			best_top = top;
+			best_span = skyline[i].width;
+		}
+	}
+	if (best_index == skyline.size())
+		return false;
 
-		uint16_t language, segCountX2;// , searchRange, entrySelector, rangeShift;
-		get2b(&language, data + cmap_subtable_offset); cmap_subtable_offset += sizeof(uint16_t);
-		get2b(&segCountX2, data + cmap_subtable_offset); cmap_subtable_offset += sizeof(uint16_t);
-		//get2b(&searchRange, data + cmap_subtable_offset); cmap_subtable_offset += sizeof(uint16_t);
-		//get2b(&entrySelector, data + cmap_subtable_offset); cmap_subtable_offset += sizeof(uint16_t);
-		//get2b(&rangeShift, data + cmap_subtable_offset); cmap_subtable_offset += sizeof(uint16_t);
-		cmap_subtable_offset += sizeof(uint16_t) * 3;
-
-		uint16_t segCount = segCountX2 >> 1;
-		std::vector<uint16_t> endCount(segCount), startCount(segCount), idRangeOffset(segCount);
-		std::vector<int16_t> idDelta(segCount);
-		for (uint16_t j = 0; j < segCount; j++) {
-			get2b(&endCount[j], data + cmap_subtable_offset); cmap_subtable_offset += sizeof(uint16_t);
-		}
-		cmap_subtable_offset += sizeof(uint16_t);
-		for (uint16_t j = 0; j < segCount; j++) {
-			get2b(&startCount[j], data + cmap_subtable_offset);
-			get2b(&idDelta[j], data + cmap_subtable_offset + sizeof(uint16_t) * segCount);
-			get2b(&idRangeOffset[j], data + cmap_subtable_offset + sizeof(uint16_t) * segCount * 2);
-			if (idRangeOffset[j] == 0) {
-				for (uint32_t k = startCount[j]; k <= endCount[j]; k++) {
-					glyph_map[k] = k + idDelta[j];
-					glyph_reverse_map[k + idDelta[j]] = k;
-				}
-			}
-			else {
-				uint32_t glyph_address_offset = cmap_subtable_offset + sizeof(uint16_t) * segCount * 2; //idRangeOffset_ptr
-				for (uint32_t k = startCount[j]; k <= endCount[j]; k++) {
-					uint32_t glyph_address_index_offset = idRangeOffset[j] + 2 * (k - startCount[j]) + glyph_address_offset;
-					uint16_t& glyph_map_value = glyph_map[k];
-					get2b(&glyph_map_value, data + glyph_address_index_offset);
-					glyph_map_value += idDelta[j];
-					glyph_reverse_map[glyph_map_value] = k;
-				}
-			}
-			cmap_subtable_offset += sizeof(uint16_t);
+	x = skyline[best_index].x;
+	y = best_top;
+	skyline.insert(skyline.begin() + best_index, { x, best_bottom, rect_width });
+	const uint32_t rect_end = x + rect_width;
+	size_t next = best_index + 1;
+	while (next < skyline.size() && skyline[next].x < rect_end) {
+		SkylineNode& node = skyline[next];
+		const uint32_t overlap = rect_end - node.x;
+		if (overlap < node.width) {
+			node.x += overlap;
+			node.width -= overlap;
+			break;
 		}
-		valid_cmap_table = true;
-		break;
+		skyline.erase(skyline.begin() + next);
 	}
-	if (!valid_cmap_table)
-		TTFDEBUG_PRINT("ttf-parser: No valid cmap table found\n");
+	for (size_t i = 0; i + 1 < skyline.size();) {
+		if (skyline[i].y == skyline[i + 1].y) {
+			skyline[i].width += skyline[i + 1].width;
+			skyline.erase(skyline.begin() + i + 1);
+		}
+		else
+			i++;
+	}
+	return true;
+}
 
-	HHEATable hhea_table;
-	auto hhea_table_entry = table_map.find("hhea");
-	if (hhea_table_entry == table_map.end())
-		return -2;
-	uint32_t hhea_offset = hhea_table.parse(data, hhea_table_entry->second.offsetPos);
+void TTFFontParser::GlyphBitmapCache::reset(uint32_t atlas_width, uint32_t atlas_height) {
+	clear();
+	atlas.reset(atlas_width, atlas_height);
+}
 
-	auto glyf_table_entry = table_map.find("glyf");
-	if (glyf_table_entry == table_map.end())
-		return -2;
-	uint32_t glyf_offset = glyf_table_entry->second.offsetPos;
+void TTFFontParser::GlyphBitmapCache::clear() {
+	entries.clear();
+	lookup.clear();
+	num_bytes = 0;
+}
 
-	auto kern_table_entry = table_map.find("kern");
-	uint32_t kern_offset = 0;
-	if (kern_table_entry != table_map.end())
-		kern_offset = kern_table_entry->second.offsetPos;
+namespace TTFFontParser {
+	inline uint32_t glyph_bitmap_subpixel(uint32_t subpixel_steps, float pen_x) {
+		const uint32_t steps = std::max<uint32_t>(1, std::min<uint32_t>(subpixel_steps, 256));
+		return std::min(steps - 1, uint32_t((pen_x - floorf(pen_x)) * float(steps)));
+	}
 
-	auto hmtx_table_entry = table_map.find("hmtx");
-	if (hmtx_table_entry == table_map.end())
-		return -2;
-	uint32_t hmtx_offset = hmtx_table_entry->second.offsetPos;
-	uint16_t last_glyph_advance_width = 0;
+	inline uint64_t glyph_bitmap_key(const Glyph& glyph, float pixel_size, uint32_t subpixel) {
+		const uint32_t size_key = uint32_t(pixel_size * 64.f + 0.5f); //1/64 pixel steps
+		return (uint64_t(uint16_t(glyph.glyph_index)) << 48) | (uint64_t(size_key) << 8) | subpixel;
+	}
 
-	std::vector<std::vector<uint16_t>> point_index((max_profile.maxContours < 4096) ? max_profile.maxContours : 4096);
-	std::vector<uint16_t> points_per_contour((max_profile.maxContours < 4096) ? max_profile.maxContours : 4096);
+	//Copy of an instanced composite glyph that refers to its expanded paths, expand writes them to the cleared scratch geometry
+	template<typename Expand>
+	Glyph expand_bitmap_glyph(const Glyph& glyph, RasterScratch& scratch, Expand expand) {
+		Glyph expanded = glyph;
+		expanded.components.clear();
+		expanded.path_list.clear();
+		scratch.path_ranges.clear();
+		scratch.curves.clear();
+		expand(scratch.path_ranges, scratch.curves);
+		expanded.first_path = 0;
+		expanded.num_paths = uint32_t(scratch.path_ranges.size());
+		return expanded;
+	}
+}
 
-	if (!max_profile.numGlyphs)
-		return -1;
+const TTFFontParser::GlyphBitmapCache::Entry* TTFFontParser::GlyphBitmapCache::get(FontFace& face, uint16_t glyph_index, float pixel_size, float pen_x) {
+	const Glyph* glyph = face.get_glyph_by_index(glyph_index);
+	if (!glyph)
+		return nullptr;
+	const float units_per_em = float(face.meta_data.unitsPerEm);
+	//cached bitmaps do not need the expanded geometry
+	if (!glyph->components.empty() && !lookup.count(glyph_bitmap_key(*glyph, pixel_size, glyph_bitmap_subpixel(subpixel_steps, pen_x)))) {
+		const Glyph expanded = expand_bitmap_glyph(*glyph, scratch, [&](std::vector<PathRange>& path_ranges, std::vector<Curve>& curves) {
+			face.expand_glyph(glyph_index, path_ranges, curves);
+		});
+		return get(expanded, scratch.path_ranges.data(), scratch.curves.data(), units_per_em, pixel_size, pen_x);
+	}
+	const GlyphStore& store = *face.glyph_store;
+	return get(*glyph, store.path_ranges.data(), store.curves.data(), units_per_em, pixel_size, pen_x);
+}
 
-	bool* glyph_loaded = new bool[max_profile.numGlyphs];
-	memset(glyph_loaded, 0, sizeof(bool) * max_profile.numGlyphs);
+const TTFFontParser::GlyphBitmapCache::Entry* TTFFontParser::GlyphBitmapCache::get(const FontData& font_data, uint32_t character, float pixel_size, float pen_x) {
+	const auto glyph = font_data.glyphs.find(character);
+	if (glyph == font_data.glyphs.end())
+		return nullptr;
+	const float units_per_em = float(font_data.meta_data.unitsPerEm);
+	if (!glyph->second.components.empty() && !lookup.count(glyph_bitmap_key(glyph->second, pixel_size, glyph_bitmap_subpixel(subpixel_steps, pen_x)))) {
+		const Glyph expanded = expand_bitmap_glyph(glyph->second, scratch, [&](std::vector<PathRange>& path_ranges, std::vector<Curve>& curves) {
+			expand_glyph(font_data, glyph->second, path_ranges, curves);
+		});
+		return get(expanded, scratch.path_ranges.data(), scratch.curves.data(), units_per_em, pixel_size, pen_x);
+	}
+	return get(glyph->second, font_data.path_ranges.data(), font_data.curves.data(), units_per_em, pixel_size, pen_x);
+}
 
-	auto parse_glyph = [&](uint16_t i, auto&& self) -> int8_t {
-		if (glyph_loaded[i] == true)
-			return 1;
+const TTFFontParser::GlyphBitmapCache::Entry* TTFFontParser::GlyphBitmapCache::get(const Glyph& glyph, const PathRange* path_ranges, const Curve* curves, float units_per_em, float pixel_size, float pen_x) {
+	const uint32_t steps = std::max<uint32_t>(1, std::min<uint32_t>(subpixel_steps, 256));
+	const uint32_t subpixel = glyph_bitmap_subpixel(subpixel_steps, pen_x);
+	const uint64_t key = glyph_bitmap_key(glyph, pixel_size, subpixel);
+	const auto found = lookup.find(key);
+	if (found != lookup.end()) {
+		hits++;
+		entries.splice(entries.begin(), entries, found->second);
+		return &entries.front();
+	}
+	misses++;
 
-		const auto glyph_character_index = glyph_reverse_map[i];
+	entries.push_front({ key, GlyphBitmap(), 0, 0 });
+	Entry& entry = entries.front();
+	rasterize_glyph(glyph, path_ranges, curves, units_per_em > 0.f ? pixel_size / units_per_em : 0.f, float(subpixel) / float(steps), entry.bitmap, scratch);
+	if (atlas.width && entry.bitmap.width) {
+		if (!atlas.pack(entry.bitmap.width + atlas_padding, entry.bitmap.height + atlas_padding, entry.atlas_x, entry.atlas_y)) {
+			//everything placed so far has to go, the new glyph starts the next generation
+			entries.erase(std::next(entries.begin()), entries.end());
+			lookup.clear();
+			num_bytes = 0;
+			atlas.reset(atlas.width, atlas.height);
+			atlas_generation++;
+			if (!atlas.pack(entry.bitmap.width + atlas_padding, entry.bitmap.height + atlas_padding, entry.atlas_x, entry.atlas_y)) {
+				entries.pop_front();
+				return nullptr;
+			}
+		}
+	}
+	lookup[key] = entries.begin();
+	num_bytes += entry.bitmap.pixels.size();
+	while (num_bytes > byte_budget && entries.size() > 1) {
+		const Entry& oldest = entries.back();
+		num_bytes -= oldest.bitmap.pixels.size();
+		lookup.erase(oldest.key);
+		entries.pop_back();
+	}
+	return &entry;
+}
 
-		Glyph& current_glyph = font_data->glyphs[glyph_character_index];
-		current_glyph.glyph_index = i;
-		current_glyph.character = glyph_character_index;
+void TTFFontParser::TextMeasure::build(const FontData& font_data) {
+	character_map = &font_data.character_map;
+	kerning_table = font_data.has_kearning_table ? &font_data.kearning_table : nullptr;
+	advance_widths.assign(font_data.character_map.characters.size(), 0);
+	for (const auto& glyph : font_data.glyphs) {
+		const uint16_t glyph_index = uint16_t(glyph.second.glyph_index);
+		if (glyph_index >= advance_widths.size())
+			advance_widths.resize(size_t(glyph_index) + 1, 0);
+		advance_widths[glyph_index] = glyph.second.advance_width;
+	}
+	for (uint32_t c = 0; c < 128; c++)
+		ascii_glyphs[c] = character_map->get_glyph_index(c);
+	ascii_kerning.clear();
+	if (kerning_table) {
+		ascii_kerning.resize(128 * 128);
+		for (uint32_t left = 0; left < 128; left++)
+			for (uint32_t right = 0; right < 128; right++)
+				ascii_kerning[left * 128 + right] = kerning_table->get_kerning(ascii_glyphs[left], ascii_glyphs[right]);
+	}
+}
 
-		if (i < hhea_table.numberOfHMetrics) {
-			get2b(&current_glyph.advance_width, data + hmtx_offset + i * sizeof(uint32_t));
-			last_glyph_advance_width = current_glyph.advance_width;
-			get2b(&current_glyph.left_side_bearing, data + hmtx_offset + i * sizeof(uint32_t) + sizeof(uint16_t));
+void TTFFontParser::TextMeasure::build(const FontFace& face) {
+	character_map = &face.character_map;
+	kerning_table = nullptr;
+	ascii_kerning.clear();
+	advance_widths.assign(face.num_glyphs(), 0);
+	if (face.glyph_store && face.glyph_store->number_of_h_metrics) {
+		const GlyphStore& store = *face.glyph_store;
+		for (uint32_t i = 0; i < advance_widths.size(); i++) {
+			const uint32_t metric = std::min<uint32_t>(i, store.number_of_h_metrics - 1u); //glyphs past numberOfHMetrics repeat the last advance
+			get2b(&advance_widths[i], store.data + store.hmtx_offset + metric * sizeof(uint32_t));
 		}
-		else
-			current_glyph.advance_width = last_glyph_advance_width;
-
-		if (i != max_profile.numGlyphs - 1 && glyph_index[i] == glyph_index[i + 1]) {
-			glyph_loaded[i] = true;
-			return -1;
-		}
-		if (glyph_index[i] >= end_of_glyf)
-			return -1;
-
-		uint32_t current_offset = glyf_offset + glyph_index[i];
-
-		get2b(&current_glyph.num_contours, data + current_offset); current_offset += sizeof(int16_t);
-		get2b(&current_glyph.bounding_box[0], data + current_offset); current_offset += sizeof(int16_t);
-		get2b(&current_glyph.bounding_box[1], data + current_offset); current_offset += sizeof(int16_t);
-		get2b(&current_glyph.bounding_box[2], data + current_offset); current_offset += sizeof(int16_t);
-		get2b(&current_glyph.bounding_box[3], data + current_offset); current_offset += sizeof(int16_t);
-
-		current_glyph.glyph_center.x = (current_glyph.bounding_box[0] + current_glyph.bounding_box[2]) / 2.0f;
-		current_glyph.glyph_center.y = (current_glyph.bounding_box[1] + current_glyph.bounding_box[3]) / 2.0f;
-
-		if (current_glyph.num_contours > 0) { //Simple glyph
-			std::vector<uint16_t> contour_end(current_glyph.num_contours);
-			current_glyph.path_list.resize(current_glyph.num_contours);
-			for (uint16_t j = 0; j < current_glyph.num_contours; j++) {
-				get2b(&contour_end[j], data + current_offset); current_offset += sizeof(uint16_t);
-			}
-			for (uint16_t j = 0; j < current_glyph.num_contours; j++) {
-				uint16_t num_points = contour_end[j] - (j ? contour_end[j - 1] : -1);
-				if (point_index[j].size() < num_points)
-					point_index[j].resize(num_points);
-				points_per_contour[j] = num_points;
-			}
-
-			//Skip instructions
-			uint16_t num_instructions;
-			get2b(&num_instructions, data + current_offset); current_offset += sizeof(uint16_t);
-			current_offset += sizeof(uint8_t) * num_instructions;
-
-			uint16_t num_points = contour_end[current_glyph.num_contours - 1] + 1;
-			std::vector<uint8_t> flags(num_points);
-			std::vector<Flags> flagsEnum(num_points);
-			std::vector<uint16_t> contour_index(num_points);
-			uint16_t current_contour_index = 0;
-			int16_t repeat = 0;
-			uint16_t coutour_count_first_point = 0;
-			for (uint16_t j = 0; j < num_points; j++, coutour_count_first_point++) {
-				if (repeat == 0) {
-					get1b(&flags[j], data + current_offset); current_offset += sizeof(uint8_t);
-					if (flags[j] & 0x8) {
-						get1b(&repeat, data + current_offset); current_offset += sizeof(uint8_t);
-					}
-				}
-				else {
-					flags[j] = flags[j - 1];
-					repeat--;
-				}
-				flagsEnum[j].offCurve = (!(flags[j] & 0b00000001)) != 0;
-				flagsEnum[j].xShort = (flags[j] & 0b00000010) != 0;
-				flagsEnum[j].yShort = (flags[j] & 0b00000100) != 0;
-				flagsEnum[j].repeat = (flags[j] & 0b00001000) != 0;
-				flagsEnum[j].xDual = (flags[j] & 0b00010000) != 0;
-				flagsEnum[j].yDual = (flags[j] & 0b00100000) != 0;
-				if (j > contour_end[current_contour_index]) {
-					current_contour_index++;
-					coutour_count_first_point = 0;
-				}
-				contour_index[j] = current_contour_index;
-				point_index[current_contour_index][coutour_count_first_point] = j;
-			}
-			uint16_t current_flag_size = 1;
-			std::vector<int16_v2> points;
-			points.resize(num_points);
-			for (uint16_t j = 0; j < num_points; j++) {
-				if (flagsEnum[j].xDual && !flagsEnum[j].xShort)
-					points[j].x = j ? points[j - 1].x : 0;
-				else {
-					if (flagsEnum[j].xShort) {
-						get1b(&points[j].x, data + current_offset); current_offset += 1;
-					}
-					else {
-						get2b(&points[j].x, data + current_offset); current_offset += 2;
-					}
-					if (flagsEnum[j].xShort && !flagsEnum[j].xDual)
-						points[j].x *= -1;
-					if (j != 0)
-						points[j].x += points[j - 1].x;
-				}
+	}
+	for (uint32_t c = 0; c < 128; c++)
+		ascii_glyphs[c] = character_map->get_glyph_index(c);
+}
+
+namespace TTFFontParser {
+	//Next codepoint of UTF-8 text, U+FFFD for an invalid or truncated sequence which then consumes one byte
+	inline uint32_t decode_utf8(const uint8_t*& text, const uint8_t* end) {
+		const uint32_t lead = *text;
+		uint32_t length, character;
+		if (lead < 0xC2 || lead > 0xF4) {
+			text++;
+			return lead < 0x80 ? lead : 0xFFFD;
+		}
+		else if (lead < 0xE0) {
+			length = 2;
+			character = lead & 0x1F;
+		}
+		else if (lead < 0xF0) {
+			length = 3;
+			character = lead & 0x0F;
+		}
+		else {
+			length = 4;
+			character = lead & 0x07;
+		}
+		if (size_t(end - text) < length) {
+			text++;
+			return 0xFFFD;
+		}
+		for (uint32_t i = 1; i < length; i++) {
+			if ((text[i] & 0xC0) != 0x80) {
+				text++;
+				return 0xFFFD;
 			}
-			for (uint16_t j = 0; j < num_points; j++) {
-				if (flagsEnum[j].yDual && !flagsEnum[j].yShort)
-					points[j].y = j ? points[j - 1].y : 0;
-				else {
-					if (flagsEnum[j].yShort) {
-						get1b(&points[j].y, data + current_offset); current_offset += 1;
-					}
-					else {
-						get2b(&points[j].y, data + current_offset); current_offset += 2;
-					}
-					if (flagsEnum[j].yShort && !flagsEnum[j].yDual)
-						points[j].y *= -1;
-					if (j != 0)
-						points[j].y += points[j - 1].y;
-				}
+			character = (character << 6) | (text[i] & 0x3F);
+		}
+		//overlong, surrogate or beyond U+10FFFF
+		static const uint32_t min_character[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+		if (character < min_character[length] || (character >= 0xD800 && character <= 0xDFFF) || character > 0x10FFFF) {
+			text++;
+			return 0xFFFD;
+		}
+		text += length;
+		return character;
+	}
+
+	//Pen positions are written through store(index, pen) so both the integer and the scaled API share the loop
+	template<typename Store>
+	int32_t measure_text_utf8(const TextMeasure& measure, const char* text, size_t length, Store store) {
+		const uint8_t* current = (const uint8_t*)text;
+		const uint8_t* end = current + length;
+		const bool has_kerning = measure.kerning_table != nullptr;
+		const int16_t* ascii_kerning = measure.ascii_kerning.empty() ? nullptr : measure.ascii_kerning.data();
+		int32_t pen = 0;
+		size_t index = 0;
+		uint32_t previous_character = 0xFFFFFFFF;
+		uint16_t previous_glyph = 0;
+		while (current < end) {
+			//ASCII runs only touch the small tables
+			if (*current < 0x80) {
+				const uint32_t character = *current++;
+				if (previous_character < 128 && ascii_kerning)
+					pen += ascii_kerning[previous_character * 128 + character];
+				else if (index && has_kerning)
+					pen += measure.kerning_table->get_kerning(previous_glyph, measure.ascii_glyphs[character]);
+				store(index++, pen);
+				previous_glyph = measure.ascii_glyphs[character];
+				previous_character = character;
+				pen += measure.get_advance(previous_glyph);
+				continue;
 			}
+			const uint32_t character = decode_utf8(current, end);
+			const uint16_t glyph_index = measure.get_glyph_index(character);
+			if (index && has_kerning)
+				pen += measure.kerning_table->get_kerning(previous_glyph, glyph_index);
+			store(index++, pen);
+			previous_glyph = glyph_index;
+			previous_character = character;
+			pen += measure.get_advance(glyph_index);
+		}
+		return pen;
+	}
 
-			//Generate contours
-			for (uint16_t j = 0; j < current_glyph.num_contours; j++) {
-				const uint16_t& num_points_per_contour = points_per_contour[j];
-				float_v2 prev_point;
-				const uint16_t& point_index_0 = point_index[j][0];
-				const Flags& flags_0 = flagsEnum[point_index_0];
-				//If the first point is off curve
-				if (flags_0.offCurve) {
-					const uint16_t& point_index_m1 = point_index[j][num_points_per_contour - 1];
-					const Flags& flags_m1 = flagsEnum[point_index_m1];
-					const int16_v2& p0 = points[point_index_0];
-					const int16_v2& pm1 = points[point_index_m1];
-					if (flags_m1.offCurve) {
-						prev_point.x = (p0.x + pm1.x) / 2.0f;
-						prev_point.y = (p0.y + pm1.y) / 2.0f;
-					}
-					else {
-						prev_point.x = pm1.x;
-						prev_point.y = pm1.y;
-					}
-				}
-				for (uint16_t k = 0; k < num_points_per_contour; k++) {
-					const uint16_t& point_index0 = point_index[j][k % num_points_per_contour];
-					const uint16_t& point_index1 = point_index[j][(k + 1) % num_points_per_contour];
-					const Flags& flags0 = flagsEnum[point_index0];
-					const Flags& flags1 = flagsEnum[point_index1];
-					const int16_v2& p0 = points[point_index0];
-					const int16_v2& p1 = points[point_index1];
-					Curve curve;
-					if (flags0.offCurve) {
-						curve.p0.x = prev_point.x;
-						curve.p0.y = prev_point.y;
-						curve.p1.x = p0.x;
-						curve.p1.y = p0.y;
-						if (flags1.offCurve) {
-							curve.c.x = (p0.x + p1.x) / 2.0f;
-							curve.c.y = (p0.y + p1.y) / 2.0f;
-
-							prev_point = curve.c;
-						}
-						else {
-							curve.c.x = p1.x;
-							curve.c.y = p1.y;
-							//No change to prev_point
-						}
-					}
-					else if (!flags1.offCurve) {
-						curve.p0.x = p0.x;
-						curve.p0.y = p0.y;
-						curve.p1.x = p1.x;
-						curve.p1.y = p1.y;
-						curve.c.x = current_glyph.glyph_center.x;
-						curve.c.y = current_glyph.glyph_center.y;
-
-						prev_point.x = p0.x;
-						prev_point.y = p0.y;
-					}
-					else {
-						const uint16_t& point_index2 = point_index[j][(k + 2) % num_points_per_contour];
-						const Flags& flags2 = flagsEnum[point_index2];
-						const int16_v2& p2 = points[point_index2];
-						if (flags2.offCurve) {
-							curve.p0.x = p0.x;
-							curve.p0.y = p0.y;
-							curve.p1.x = p1.x;
-							curve.p1.y = p1.y;
-							curve.c.x = (p1.x + p2.x) / 2.0f;
-							curve.c.y = (p1.y + p2.y) / 2.0f;
-
-							prev_point = curve.c;
-
-						}
-						else {
-							curve.p0.x = p0.x;
-							curve.p0.y = p0.y;
-							curve.p1.x = p1.x;
-							curve.p1.y = p1.y;
-							curve.c.x = p2.x;
-							curve.c.y = p2.y;
-
-							prev_point.x = p0.x;
-							prev_point.y = p0.y;
-						}
-					}
-					if (flags0.offCurve || flags1.offCurve) {
-						curve.is_curve = true;
-						if (flags0.offCurve == false)
-							k++;
-					}
-					else
-						curve.is_curve = false;
-					current_glyph.path_list[j].geometry.push_back(std::move(curve));
-				}
+	template<typename Store>
+	int32_t measure_text_utf32(const TextMeasure& measure, const uint32_t* text, size_t length, Store store) {
+		const bool has_kerning = measure.kerning_table != nullptr;
+		const int16_t* ascii_kerning = measure.ascii_kerning.empty() ? nullptr : measure.ascii_kerning.data();
+		int32_t pen = 0;
+		uint16_t previous_glyph = 0;
+		for (size_t i = 0; i < length; i++) {
+			const uint32_t character = text[i];
+			const uint16_t glyph_index = measure.get_glyph_index(character);
+			if (i && has_kerning) {
+				if (ascii_kerning && character < 128 && text[i - 1] < 128)
+					pen += ascii_kerning[text[i - 1] * 128 + character];
+				else
+					pen += measure.kerning_table->get_kerning(previous_glyph, glyph_index);
 			}
+			store(i, pen);
+			previous_glyph = glyph_index;
+			pen += measure.get_advance(glyph_index);
 		}
+		return pen;
+	}
+}
 
-		else { //Composite glyph
-			for (auto compound_glyph_index = 0; compound_glyph_index < -current_glyph.num_contours; compound_glyph_index++) {
-				uint16_t glyf_flags, glyphIndex;
-				do {
-					get2b(&glyf_flags, data + current_offset); current_offset += sizeof(uint16_t);
-					get2b(&glyphIndex, data + current_offset); current_offset += sizeof(uint16_t);
+int32_t TTFFontParser::TextMeasure::measure_utf8(const char* text, size_t length, int32_t* positions) const {
+	if (!positions)
+		return measure_text_utf8(*this, text, length, [](size_t, int32_t) {});
+	return measure_text_utf8(*this, text, length, [positions](size_t index, int32_t pen) { positions[index] = pen; });
+}
 
-					int16_t glyf_args1, glyf_args2;
-					int8_t glyf_args1_u8, glyf_args2_u8;
-					bool is_word = false;
-					if (glyf_flags & ARG_1_AND_2_ARE_WORDS) {
-						get2b(&glyf_args1, data + current_offset); current_offset += sizeof(int16_t);
-						get2b(&glyf_args2, data + current_offset); current_offset += sizeof(int16_t);
-						is_word = true;
-					}
-					else {
-						get1b(&glyf_args1_u8, data + current_offset); current_offset += sizeof(int8_t);
-						get1b(&glyf_args2_u8, data + current_offset); current_offset += sizeof(int8_t);
-					}
+int32_t TTFFontParser::TextMeasure::measure_utf32(const uint32_t* text, size_t length, int32_t* positions) const {
+	if (!positions)
+		return measure_text_utf32(*this, text, length, [](size_t, int32_t) {});
+	return measure_text_utf32(*this, text, length, [positions](size_t index, int32_t pen) { positions[index] = pen; });
+}
 
-					float composite_glyph_element_transformation[6] = { 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f };
+float TTFFontParser::TextMeasure::measure_utf8(const char* text, size_t length, float scale, float* positions) const {
+	if (!positions)
+		return float(measure_text_utf8(*this, text, length, [](size_t, int32_t) {})) * scale;
+	return float(measure_text_utf8(*this, text, length, [positions, scale](size_t index, int32_t pen) { positions[index] = float(pen) * scale; })) * scale;
+}
 
-					if (glyf_flags & WE_HAVE_A_SCALE) {
-						int16_t xy_value;
-						get2b(&xy_value, data + current_offset); current_offset += sizeof(int16_t);
-						composite_glyph_element_transformation[0] = to_2_14_float(xy_value);
-						composite_glyph_element_transformation[3] = to_2_14_float(xy_value);
-					}
-					else if (glyf_flags & WE_HAVE_AN_X_AND_Y_SCALE) {
-						int16_t xy_values[2];
-						get2b(&xy_values[0], data + current_offset); current_offset += sizeof(int16_t);
-						get2b(&xy_values[1], data + current_offset); current_offset += sizeof(int16_t);
-						composite_glyph_element_transformation[0] = to_2_14_float(xy_values[0]);
-						composite_glyph_element_transformation[3] = to_2_14_float(xy_values[1]);
-					}
-					else if (glyf_flags & WE_HAVE_A_TWO_BY_TWO) {
-						int16_t xy_values[4];
-						get2b(&xy_values[0], data + current_offset); current_offset += sizeof(int16_t);
-						get2b(&xy_values[1], data + current_offset); current_offset += sizeof(int16_t);
-						get2b(&xy_values[2], data + current_offset); current_offset += sizeof(int16_t);
-						get2b(&xy_values[3], data + current_offset); current_offset += sizeof(int16_t);
-						composite_glyph_element_transformation[0] = to_2_14_float(xy_values[0]);
-						composite_glyph_element_transformation[1] = to_2_14_float(xy_values[1]);
-						composite_glyph_element_transformation[2] = to_2_14_float(xy_values[2]);
-						composite_glyph_element_transformation[3] = to_2_14_float(xy_values[3]);
-					}
+float TTFFontParser::TextMeasure::measure_utf32(const uint32_t* text, size_t length, float scale, float* positions) const {
+	if (!positions)
+		return float(measure_text_utf32(*this, text, length, [](size_t, int32_t) {})) * scale;
+	return float(measure_text_utf32(*this, text, length, [positions, scale](size_t index, int32_t pen) { positions[index] = float(pen) * scale; })) * scale;
+}
 
-					bool matched_points = false;
-					if (glyf_flags & ARGS_ARE_XY_VALUES) {
-						composite_glyph_element_transformation[4] = float(is_word ? glyf_args1 : glyf_args1_u8);
-						composite_glyph_element_transformation[5] = float(is_word ? glyf_args2 : glyf_args2_u8);
-						if (glyf_flags & SCALED_COMPONENT_OFFSET) {
-							composite_glyph_element_transformation[4] *= composite_glyph_element_transformation[0];
-							composite_glyph_element_transformation[5] *= composite_glyph_element_transformation[3];
-						}
-					}
-					else {
-						matched_points = true;
-					}
+void TTFFontParser::KerningTable::parse(const char* data, uint32_t kern_offset, uint16_t num_glyphs) {
+	class_subtables.clear();
+	std::vector<KerningPair> pairs;
+	uint32_t current_offset = kern_offset;
+	uint16_t kern_table_version, num_kern_subtables;
+	get2b(&kern_table_version, data + current_offset); current_offset += sizeof(uint16_t);
+	get2b(&num_kern_subtables, data + current_offset); current_offset += sizeof(uint16_t);
+	uint16_t kern_length = 0;
+	uint32_t kern_start_offset = current_offset;
+	for (uint16_t kern_subtable_index = 0; kern_subtable_index < num_kern_subtables; kern_subtable_index++) {
+		uint16_t kern_version, kern_converage;
+		current_offset = kern_start_offset + kern_length;
+		kern_start_offset = current_offset;
+		get2b(&kern_version, data + current_offset); current_offset += sizeof(uint16_t);
+		get2b(&kern_length, data + current_offset); current_offset += sizeof(uint16_t);
+		if (kern_version != 0)
+			continue;
+		get2b(&kern_converage, data + current_offset); current_offset += sizeof(uint16_t);
 
-					//Skip instructions
-					if (glyf_flags & WE_HAVE_INSTRUCTIONS) {
-						uint16_t num_instructions = 0;
-						get2b(&num_instructions, data + current_offset); current_offset += sizeof(uint16_t);
-						current_offset += sizeof(uint8_t) * num_instructions;
-					}
+		uint16_t num_kern_pairs;
+		get2b(&num_kern_pairs, data + current_offset); current_offset += sizeof(uint16_t);
+		current_offset += sizeof(uint16_t) * 3;
+		pairs.reserve(pairs.size() + num_kern_pairs);
+		for (uint16_t kern_index = 0; kern_index < num_kern_pairs; kern_index++) {
+			uint16_t kern_left, kern_right;
+			int16_t kern_value;
+			get2b(&kern_left, data + current_offset); current_offset += sizeof(uint16_t);
+			get2b(&kern_right, data + current_offset); current_offset += sizeof(uint16_t);
+			get2b(&kern_value, data + current_offset); current_offset += sizeof(int16_t);
+			pairs.push_back({ (uint32_t(kern_left) << 16) | kern_right, kern_value });
+		}
+	}
+	build(pairs, num_glyphs);
+}
+
+/*
+* GPOS lookups of the kern feature, pair adjustment (type 2) directly or through extension lookups (type 9)
+* Only the x advance of the first glyph is used. Explicit pairs are kept as pairs, class based subtables stay as class matrices
+*/
+bool TTFFontParser::KerningTable::parse_gpos(const char* data, uint32_t gpos_offset, uint32_t gpos_length, uint16_t num_glyphs) {
+	BoundedReader gpos(data + gpos_offset, gpos_length);
+	const uint32_t feature_list_offset = gpos.u16(sizeof(uint16_t) * 3);
+	const uint32_t lookup_list_offset = gpos.u16(sizeof(uint16_t) * 4);
+	if (!gpos.valid || !feature_list_offset || !lookup_list_offset)
+		return false;
+
+	std::vector<uint16_t> lookup_indices;
+	const uint16_t feature_count = gpos.u16(feature_list_offset);
+	for (uint32_t i = 0; i < feature_count && gpos.valid; i++) {
+		const uint32_t feature_record = feature_list_offset + sizeof(uint16_t) + i * (sizeof(uint32_t) + sizeof(uint16_t));
+		if (gpos.u32(feature_record) != 0x6B65726E) //'kern'
+			continue;
+		const uint32_t feature_offset = feature_list_offset + gpos.u16(feature_record + sizeof(uint32_t));
+		const uint16_t lookup_index_count = gpos.u16(feature_offset + sizeof(uint16_t));
+		for (uint32_t j = 0; j < lookup_index_count && gpos.valid; j++)
+			lookup_indices.push_back(gpos.u16(feature_offset + sizeof(uint16_t) * (2 + j)));
+	}
+	std::sort(lookup_indices.begin(), lookup_indices.end());
+	lookup_indices.erase(std::unique(lookup_indices.begin(), lookup_indices.end()), lookup_indices.end());
+
+	auto value_record_size = [](uint16_t value_format) -> uint32_t {
+		uint32_t size = 0;
+		for (uint16_t bit = 1; bit <= 0x80; bit <<= 1)
+			size += (value_format & bit) ? sizeof(int16_t) : 0;
+		return size;
+	};
+	auto x_advance_offset = [](uint16_t value_format) -> uint32_t {
+		return ((value_format & 0x1) ? sizeof(int16_t) : 0) + ((value_format & 0x2) ? sizeof(int16_t) : 0);
+	};
+	//glyphs in coverage index order
+	std::vector<uint16_t> coverage_glyphs;
+	auto read_coverage = [&](uint32_t coverage_offset) {
+		coverage_glyphs.clear();
+		const uint16_t coverage_format = gpos.u16(coverage_offset);
+		const uint16_t count = gpos.u16(coverage_offset + sizeof(uint16_t));
+		for (uint32_t i = 0; i < count && gpos.valid; i++) {
+			if (coverage_format == 1)
+				coverage_glyphs.push_back(gpos.u16(coverage_offset + sizeof(uint16_t) * (2 + i)));
+			else if (coverage_format == 2) {
+				const uint32_t range_record = coverage_offset + sizeof(uint16_t) * 2 + i * sizeof(uint16_t) * 3;
+				const uint16_t start_glyph = gpos.u16(range_record), end_glyph = gpos.u16(range_record + sizeof(uint16_t));
+				const uint16_t start_index = gpos.u16(range_record + sizeof(uint16_t) * 2);
+				if (end_glyph < start_glyph)
+					continue;
+				if (coverage_glyphs.size() < size_t(start_index) + (end_glyph - start_glyph) + 1)
+					coverage_glyphs.resize(size_t(start_index) + (end_glyph - start_glyph) + 1, 0xFFFF);
+				for (uint32_t glyph = start_glyph; glyph <= end_glyph; glyph++)
+					coverage_glyphs[start_index + (glyph - start_glyph)] = uint16_t(glyph);
+			}
+		}
+	};
+	//Class of each glyph in [first_glyph, first_glyph + classes.size())
+	auto read_class_def = [&](uint32_t class_def_offset, uint16_t& first_glyph, std::vector<uint16_t>& classes) {
+		classes.clear();
+		first_glyph = 0;
+		const uint16_t class_format = gpos.u16(class_def_offset);
+		if (class_format == 1) {
+			first_glyph = gpos.u16(class_def_offset + sizeof(uint16_t));
+			const uint16_t glyph_count = gpos.u16(class_def_offset + sizeof(uint16_t) * 2);
+			classes.resize(glyph_count);
+			for (uint32_t i = 0; i < glyph_count && gpos.valid; i++)
+				classes[i] = gpos.u16(class_def_offset + sizeof(uint16_t) * (3 + i));
+		}
+		else if (class_format == 2) {
+			const uint16_t range_count = gpos.u16(class_def_offset + sizeof(uint16_t));
+			uint32_t min_glyph = 0xFFFF, max_glyph = 0;
+			for (uint32_t i = 0; i < range_count && gpos.valid; i++) {
+				const uint32_t range_record = class_def_offset + sizeof(uint16_t) * 2 + i * sizeof(uint16_t) * 3;
+				const uint16_t start_glyph = gpos.u16(range_record), end_glyph = gpos.u16(range_record + sizeof(uint16_t));
+				if (end_glyph < start_glyph)
+					continue;
+				min_glyph = std::min<uint32_t>(min_glyph, start_glyph);
+				max_glyph = std::max<uint32_t>(max_glyph, end_glyph);
+			}
+			if (min_glyph > max_glyph)
+				return;
+			first_glyph = uint16_t(min_glyph);
+			classes.assign(max_glyph - min_glyph + 1, 0);
+			for (uint32_t i = 0; i < range_count && gpos.valid; i++) {
+				const uint32_t range_record = class_def_offset + sizeof(uint16_t) * 2 + i * sizeof(uint16_t) * 3;
+				const uint16_t start_glyph = gpos.u16(range_record), end_glyph = gpos.u16(range_record + sizeof(uint16_t));
+				const uint16_t glyph_class = gpos.u16(range_record + sizeof(uint16_t) * 2);
+				for (uint32_t glyph = start_glyph; glyph <= end_glyph; glyph++)
+					classes[glyph - min_glyph] = glyph_class;
+			}
+		}
+	};
+
+	std::vector<KerningPair> pairs;
+	std::vector<ClassKerning> class_kerning;
+	const uint16_t lookup_count = gpos.u16(lookup_list_offset);
+	for (uint16_t lookup_index : lookup_indices) {
+		if (!gpos.valid)
+			break;
+		if (lookup_index >= lookup_count)
+			continue;
+		const uint32_t lookup_offset = lookup_list_offset + gpos.u16(lookup_list_offset + sizeof(uint16_t) * (1 + lookup_index));
+		const uint16_t lookup_type = gpos.u16(lookup_offset);
+		const uint16_t subtable_count = gpos.u16(lookup_offset + sizeof(uint16_t) * 2);
+		for (uint32_t i = 0; i < subtable_count && gpos.valid; i++) {
+			uint32_t subtable_offset = lookup_offset + gpos.u16(lookup_offset + sizeof(uint16_t) * (3 + i));
+			if (lookup_type == 9) {
+				if (gpos.u16(subtable_offset + sizeof(uint16_t)) != 2)
+					continue;
+				subtable_offset += gpos.u32(subtable_offset + sizeof(uint16_t) * 2);
+			}
+			else if (lookup_type != 2)
+				break;
 
-					if (glyph_loaded[glyphIndex] == false) {
-						if (self(glyphIndex, self) < 0) {
-							TTFDEBUG_PRINT("ttf-parser: bad glyph index %d in composite glyph\n", glyphIndex);
-							continue;
-						}
+			const uint16_t pos_format = gpos.u16(subtable_offset);
+			const uint32_t coverage_offset = subtable_offset + gpos.u16(subtable_offset + sizeof(uint16_t));
+			const uint16_t value_format1 = gpos.u16(subtable_offset + sizeof(uint16_t) * 2);
+			const uint16_t value_format2 = gpos.u16(subtable_offset + sizeof(uint16_t) * 3);
+			if (!(value_format1 & 0x4)) //no x advance on the first glyph
+				continue;
+			const uint32_t value_offset = x_advance_offset(value_format1);
+			const uint32_t record_size = value_record_size(value_format1) + value_record_size(value_format2);
+
+			if (pos_format == 1) {
+				read_coverage(coverage_offset);
+				const uint16_t pair_set_count = gpos.u16(subtable_offset + sizeof(uint16_t) * 4);
+				for (uint32_t j = 0; j < pair_set_count && j < coverage_glyphs.size() && gpos.valid; j++) {
+					const uint32_t pair_set_offset = subtable_offset + gpos.u16(subtable_offset + sizeof(uint16_t) * (5 + j));
+					const uint16_t pair_value_count = gpos.u16(pair_set_offset);
+					const uint32_t left_glyph = coverage_glyphs[j];
+					for (uint32_t k = 0; k < pair_value_count && gpos.valid; k++) {
+						const uint32_t pair_value_record = pair_set_offset + sizeof(uint16_t) + k * (sizeof(uint16_t) + record_size);
+						const uint16_t right_glyph = gpos.u16(pair_value_record);
+						//zero values are kept, an explicit pair overrides the class kerning of its glyphs
+						pairs.push_back({ (left_glyph << 16) | right_glyph, gpos.s16(pair_value_record + sizeof(uint16_t) + value_offset) });
 					}
-					auto glyph_reverse_map_find = glyph_reverse_map.find(glyphIndex);
-					if (glyph_reverse_map_find == glyph_reverse_map.end()) {
-						TTFDEBUG_PRINT("ttf-parser: composite glyph of an unseen glyph %d\n", glyphIndex);
+				}
+			}
+			else if (pos_format == 2) {
+				ClassKerning class_subtable;
+				const uint32_t class_def1_offset = subtable_offset + gpos.u16(subtable_offset + sizeof(uint16_t) * 4);
+				const uint32_t class_def2_offset = subtable_offset + gpos.u16(subtable_offset + sizeof(uint16_t) * 5);
+				const uint16_t class1_count = gpos.u16(subtable_offset + sizeof(uint16_t) * 6);
+				const uint16_t class2_count = gpos.u16(subtable_offset + sizeof(uint16_t) * 7);
+				if (!class1_count || !class2_count)
+					continue;
+				class_subtable.num_second_classes = class2_count;
+
+				//Coverage decides which left glyphs use the subtable, uncovered glyphs of the class range are marked
+				std::vector<uint16_t> class1_values;
+				uint16_t class1_first_glyph;
+				read_class_def(class_def1_offset, class1_first_glyph, class1_values);
+				read_coverage(coverage_offset);
+				uint32_t min_glyph = 0xFFFF, max_glyph = 0;
+				for (uint16_t glyph : coverage_glyphs) {
+					if (glyph == 0xFFFF)
 						continue;
-					}
-					const auto glyph_character_index = glyph_reverse_map_find->second;
-					if (glyph_character_index == 0) {
-						//TTFDEBUG_PRINT("ttf-parser: null composite %d\n", glyphIndex);
+					min_glyph = std::min<uint32_t>(min_glyph, glyph);
+					max_glyph = std::max<uint32_t>(max_glyph, glyph);
+				}
+				if (min_glyph > max_glyph)
+					continue;
+				class_subtable.first_glyph = uint16_t(min_glyph);
+				class_subtable.first_classes.assign(max_glyph - min_glyph + 1, 0xFFFF);
+				for (uint16_t glyph : coverage_glyphs) {
+					if (glyph == 0xFFFF)
 						continue;
-					}
-					Glyph& composite_glyph_element = font_data->glyphs[glyph_character_index];
-
-					auto transform_curve = [&composite_glyph_element_transformation](Curve& _in) -> Curve {
-						Curve out;
-						out.p0.x = _in.p0.x * composite_glyph_element_transformation[0] + _in.p0.y * composite_glyph_element_transformation[1] + composite_glyph_element_transformation[4];
-						out.p0.y = _in.p0.x * composite_glyph_element_transformation[2] + _in.p0.y * composite_glyph_element_transformation[3] + composite_glyph_element_transformation[5];
-						out.p1.x = _in.p1.x * composite_glyph_element_transformation[0] + _in.p1.y * composite_glyph_element_transformation[1] + composite_glyph_element_transformation[4];
-						out.p1.y = _in.p1.x * composite_glyph_element_transformation[2] + _in.p1.y * composite_glyph_element_transformation[3] + composite_glyph_element_transformation[5];
-						out.c.x = _in.c.x * composite_glyph_element_transformation[0] + _in.c.y * composite_glyph_element_transformation[1] + composite_glyph_element_transformation[4];
-						out.c.y = _in.c.x * composite_glyph_element_transformation[2] + _in.c.y * composite_glyph_element_transformation[3] + composite_glyph_element_transformation[5];
-						out.is_curve = _in.is_curve;
-						return out;
-					};
-
-					uint32_t composite_glyph_path_count = uint32_t(composite_glyph_element.path_list.size());
-					for (uint32_t glyph_point_index = 0; glyph_point_index < composite_glyph_path_count; glyph_point_index++) {
-						std::vector<Curve>& current_curves_list = composite_glyph_element.path_list[glyph_point_index].geometry;
-						uint32_t composite_glyph_path_curves_count = uint32_t(current_curves_list.size());
-						Path new_path;
-						if (matched_points == false) {
-							for (uint32_t glyph_curves_point_index = 0; glyph_curves_point_index < composite_glyph_path_curves_count; glyph_curves_point_index++) {
-								new_path.geometry.emplace_back(transform_curve(current_curves_list[glyph_curves_point_index]));
-							}
-						}
-						else {
-							TTFDEBUG_PRINT("ttf-parser: unsupported matched points in ttf composite glyph\n");
-							continue;
-						}
-						current_glyph.path_list.emplace_back(new_path);
-					}
-				} while (glyf_flags & MORE_COMPONENTS);
+					const uint32_t class_index = uint32_t(glyph - class1_first_glyph);
+					const uint16_t glyph_class = (glyph >= class1_first_glyph && class_index < class1_values.size()) ? class1_values[class_index] : 0;
+					class_subtable.first_classes[glyph - min_glyph] = (glyph_class < class1_count) ? glyph_class : 0xFFFF;
+				}
+				read_class_def(class_def2_offset, class_subtable.second_glyph, class_subtable.second_classes);
+				for (uint16_t& glyph_class : class_subtable.second_classes) {
+					if (glyph_class >= class2_count)
+						glyph_class = 0;
+				}
+
+				//The value matrix has to fit in the table before it is allocated, a bad subtable does not end the lookup
+				const uint32_t class1_records = subtable_offset + sizeof(uint16_t) * 8;
+				if (uint64_t(class1_records) + uint64_t(class1_count) * class2_count * record_size > gpos.length)
+					continue;
+				class_subtable.values.resize(uint32_t(class1_count) * class2_count);
+				bool has_values = false;
+				for (uint32_t j = 0; j < class_subtable.values.size() && gpos.valid; j++) {
+					class_subtable.values[j] = gpos.s16(class1_records + j * record_size + value_offset);
+					has_values |= class_subtable.values[j] != 0;
+				}
+				if (has_values && gpos.valid)
+					class_kerning.push_back(std::move(class_subtable));
 			}
 		}
-		glyph_loaded[i] = true;
-		return 0;
-	};
+	}
+	if (!gpos.valid)
+		TTFDEBUG_PRINT("ttf-parser: GPOS table is truncated, kerning is incomplete\n");
+
+	build(pairs, num_glyphs);
+	class_subtables = std::move(class_kerning);
+	return !empty();
+}
+
+void TTFFontParser::KerningTable::build(std::vector<KerningPair>& pairs, uint16_t num_glyphs) {
+	first_pair.clear();
+	right_glyphs.clear();
+	values.clear();
+	std::stable_sort(pairs.begin(), pairs.end(), [](const KerningPair& a, const KerningPair& b) { return a.glyph_pair < b.glyph_pair; });
+	first_pair.assign(uint32_t(num_glyphs) + 1, 0);
+	right_glyphs.reserve(pairs.size());
+	values.reserve(pairs.size());
+	for (size_t i = 0; i < pairs.size(); i++) {
+		const uint16_t left_glyph = uint16_t(pairs[i].glyph_pair >> 16);
+		if (left_glyph >= num_glyphs)
+			break;
+		if (i && pairs[i - 1].glyph_pair == pairs[i].glyph_pair)
+			continue;
+		right_glyphs.push_back(uint16_t(pairs[i].glyph_pair));
+		values.push_back(pairs[i].value);
+		first_pair[left_glyph + 1]++;
+	}
+	for (uint32_t i = 0; i < num_glyphs; i++)
+		first_pair[i + 1] += first_pair[i];
+}
 
-	for (uint16_t i = 0; i < max_profile.numGlyphs; i++) {
-		parse_glyph(i, parse_glyph);
+void TTFFontParser::KerningTable::get_kerning(const uint16_t* glyph_indices, size_t count, int16_t* adjustments) const {
+	if (!count)
+		return;
+	for (size_t i = 0; i + 1 < count; i++) {
+		const uint16_t left_glyph = glyph_indices[i];
+		if (class_subtables.empty() && (uint32_t(left_glyph) + 1 >= first_pair.size() || first_pair[left_glyph] == first_pair[left_glyph + 1])) {
+			adjustments[i] = 0; //most glyphs have no pairs
+			continue;
+		}
+		adjustments[i] = get_kerning(left_glyph, glyph_indices[i + 1]);
+	}
+	adjustments[count - 1] = 0;
+}
+namespace TTFFontParser {
+	//64 bit multiply and rotate hash over 8 byte words, used for the cache key and checksum
+	inline uint64_t cache_hash(const char* data, size_t length, uint64_t hash) {
+		const uint64_t prime = 0x100000001B3ull;
+		size_t i = 0;
+		for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+			uint64_t word;
+			memcpy(&word, data + i, sizeof(uint64_t));
+			hash = (hash ^ word) * prime;
+			hash ^= hash >> 29;
+		}
+		for (; i < length; i++)
+			hash = (hash ^ uint8_t(data[i])) * prime;
+		return hash;
 	}
+	static const uint32_t font_cache_element_size[FONT_CACHE_NUM_SECTIONS] = {
+		sizeof(FontCacheGlyph), sizeof(PathRange), sizeof(Curve), sizeof(CharacterMap::CharacterRange), sizeof(uint16_t), sizeof(uint32_t), sizeof(uint32_t),
+		sizeof(uint32_t), sizeof(uint16_t), sizeof(int16_t), sizeof(FontCacheClassKerning), sizeof(uint16_t), sizeof(FontCacheName), sizeof(char)
+	};
+}
 
-	delete[] glyph_loaded;
+uint64_t TTFFontParser::font_cache_key(const char* data, size_t length, uint32_t face_index) {
+	uint64_t hash = cache_hash((const char*)&length, sizeof(length), 0xCBF29CE484222325ull);
+	hash = cache_hash((const char*)&face_index, sizeof(face_index), hash);
+	uint32_t directory_offset;
+	if (!get_face_offset(data, length, face_index, directory_offset) || directory_offset > length - TTFHeader::Layout::size)
+		return cache_hash(data, length, hash);
+	TTFHeader header;
+	header.parse(data, directory_offset);
+	const size_t directory_size = std::min<size_t>(length - directory_offset, TTFHeader::Layout::size + size_t(header.numTables) * TableEntry::Layout::size);
+	return cache_hash(data + directory_offset, directory_size, hash);
+}
 
-	//Kearning table
-	font_data->has_kearning_table = kern_offset ? true : false;
-	if (kern_offset) {
-		uint32_t current_offset = kern_offset;
-		uint16_t kern_table_version, num_kern_subtables;
-		get2b(&kern_table_version, data + current_offset); current_offset += sizeof(uint16_t);
-		get2b(&num_kern_subtables, data + current_offset); current_offset += sizeof(uint16_t);
-		uint16_t kern_length = 0;
-		uint32_t kern_start_offset = current_offset;
-		for (uint16_t kern_subtable_index = 0; kern_subtable_index < num_kern_subtables; kern_subtable_index++) {
-			uint16_t kern_version, kern_converage;
-			current_offset = kern_start_offset + kern_length;
-			kern_start_offset = current_offset;
-			get2b(&kern_version, data + current_offset); current_offset += sizeof(uint16_t);
-			get2b(&kern_length, data + current_offset); current_offset += sizeof(uint16_t);
-			if (kern_version != 0) {
-				current_offset += kern_length - sizeof(uint16_t) * 3;
-				continue;
-			}
-			get2b(&kern_converage, data + current_offset); current_offset += sizeof(uint16_t);
+/*
+* Glyph records are stored by glyph index and their geometry is copied into one flat buffer in glyph order
+*/
+void TTFFontParser::save_font_cache(const FontData& font_data, uint64_t source_key, std::vector<char>& blob) {
+	const CharacterMap& character_map = font_data.character_map;
+	const KerningTable& kerning = font_data.kearning_table;
 
-			uint16_t num_kern_pairs;
-			get2b(&num_kern_pairs, data + current_offset); current_offset += sizeof(uint16_t);
-			current_offset += sizeof(uint16_t) * 3;
-			for (uint16_t kern_index = 0; kern_index < num_kern_pairs; kern_index++) {
-				uint16_t kern_left, kern_right;
-				int16_t kern_value;
-				get2b(&kern_left, data + current_offset); current_offset += sizeof(uint16_t);
-				get2b(&kern_right, data + current_offset); current_offset += sizeof(uint16_t);
-				get2b(&kern_value, data + current_offset); current_offset += sizeof(int16_t);
+	uint32_t num_glyphs = uint32_t(character_map.characters.size());
+	for (const auto& glyph_entry : font_data.glyphs)
+		num_glyphs = std::max<uint32_t>(num_glyphs, uint32_t(uint16_t(glyph_entry.second.glyph_index)) + 1);
+	std::vector<const Glyph*> source_glyphs(num_glyphs, nullptr);
+	for (const auto& glyph_entry : font_data.glyphs)
+		source_glyphs[uint16_t(glyph_entry.second.glyph_index)] = &glyph_entry.second;
 
-				const uint32_t kern_left_character_index = glyph_reverse_map[kern_left];
-				const uint32_t kern_right_character_index = glyph_reverse_map[kern_right];
+	std::vector<FontCacheGlyph> glyphs(num_glyphs);
+	std::vector<PathRange> path_ranges;
+	std::vector<Curve> curves;
+	for (uint32_t i = 0; i < num_glyphs; i++) {
+		FontCacheGlyph& cache_glyph = glyphs[i];
+		cache_glyph.character = character_map.get_character(uint16_t(i));
+		cache_glyph.first_path = uint32_t(path_ranges.size());
+		const Glyph* glyph = source_glyphs[i];
+		if (!glyph)
+			continue;
+		cache_glyph.character = glyph->character;
+		cache_glyph.advance_width = glyph->advance_width;
+		cache_glyph.left_side_bearing = glyph->left_side_bearing;
+		memcpy(cache_glyph.bounding_box, glyph->bounding_box, sizeof(cache_glyph.bounding_box));
+		cache_glyph.num_contours = glyph->num_contours;
+		cache_glyph.present = 1;
+		cache_glyph.glyph_center = glyph->glyph_center;
+		expand_glyph(font_data, *glyph, path_ranges, curves); //the cache has no component references
+		cache_glyph.num_paths = uint32_t(path_ranges.size()) - cache_glyph.first_path;
+	}
 
-				font_data->kearning_table[(uint64_t(kern_left_character_index) << 32) | uint64_t(kern_right_character_index)] = kern_value;
-			}
-		}
+	std::vector<FontCacheClassKerning> class_kerning;
+	std::vector<uint16_t> class_data;
+	for (const KerningTable::ClassKerning& class_subtable : kerning.class_subtables) {
+		FontCacheClassKerning record = {};
+		record.first_glyph = class_subtable.first_glyph;
+		record.second_glyph = class_subtable.second_glyph;
+		record.num_second_classes = class_subtable.num_second_classes;
+		record.first_classes = uint32_t(class_data.size());
+		record.num_first_classes = uint32_t(class_subtable.first_classes.size());
+		class_data.insert(class_data.end(), class_subtable.first_classes.begin(), class_subtable.first_classes.end());
+		record.second_classes = uint32_t(class_data.size());
+		record.num_second_entries = uint32_t(class_subtable.second_classes.size());
+		class_data.insert(class_data.end(), class_subtable.second_classes.begin(), class_subtable.second_classes.end());
+		record.values = uint32_t(class_data.size());
+		record.num_values = uint32_t(class_subtable.values.size());
+		class_data.insert(class_data.end(), class_subtable.values.begin(), class_subtable.values.end());
+		class_kerning.push_back(record);
+	}
+
+	std::vector<FontCacheName> names;
+	std::string strings;
+	for (const FontData::FontNameData& font_name : font_data.font_names) {
+		FontCacheName record = {};
+		record.platformID = font_name.platformID;
+		record.encodingID = font_name.encodingID;
+		record.languageID = font_name.languageID;
+		record.font_family = uint32_t(strings.size());
+		record.font_family_length = uint32_t(font_name.font_family.size());
+		strings += font_name.font_family;
+		record.font_style = uint32_t(strings.size());
+		record.font_style_length = uint32_t(font_name.font_style.size());
+		strings += font_name.font_style;
+		names.push_back(record);
+	}
+
+	FontCacheHeader header = {};
+	memcpy(header.magic, "TTFCACHE", sizeof(header.magic));
+	header.version = FontCache::version;
+	header.byte_order = 0x01020304;
+	header.source_key = source_key;
+	header.meta_data = font_data.meta_data;
+	header.num_glyphs = uint16_t(std::min<uint32_t>(num_glyphs, 0xFFFF));
+	header.has_kerning = font_data.has_kearning_table;
+
+	blob.assign(sizeof(FontCacheHeader), 0);
+	auto add_section = [&blob, &header](FONT_CACHE_SECTION index, const void* source, size_t count) {
+		const size_t offset = (blob.size() + 15) & ~size_t(15);
+		const size_t size = count * font_cache_element_size[index];
+		blob.resize(offset + size, 0);
+		if (size)
+			memcpy(blob.data() + offset, source, size);
+		header.sections[index] = { offset, count };
+	};
+	add_section(FONT_CACHE_GLYPHS, glyphs.data(), glyphs.size());
+	add_section(FONT_CACHE_PATH_RANGES, path_ranges.data(), path_ranges.size());
+	add_section(FONT_CACHE_CURVES, curves.data(), curves.size());
+	//Clear the padding after is_curve so equal fonts give equal blobs
+	for (size_t i = 0; i < curves.size(); i++) {
+		char* curve = blob.data() + header.sections[FONT_CACHE_CURVES].offset + i * sizeof(Curve);
+		memset(curve + offsetof(Curve, is_curve) + sizeof(bool), 0, sizeof(Curve) - offsetof(Curve, is_curve) - sizeof(bool));
 	}
+	add_section(FONT_CACHE_CHARACTER_RANGES, character_map.ranges.data(), character_map.ranges.size());
+	add_section(FONT_CACHE_GLYPH_IDS, character_map.glyph_ids.data(), character_map.glyph_ids.size());
+	add_section(FONT_CACHE_PAGE_RANGES, character_map.page_ranges.data(), character_map.page_ranges.size());
+	add_section(FONT_CACHE_CHARACTERS, character_map.characters.data(), character_map.characters.size());
+	add_section(FONT_CACHE_KERNING_FIRST_PAIR, kerning.first_pair.data(), kerning.first_pair.size());
+	add_section(FONT_CACHE_KERNING_RIGHT_GLYPHS, kerning.right_glyphs.data(), kerning.right_glyphs.size());
+	add_section(FONT_CACHE_KERNING_VALUES, kerning.values.data(), kerning.values.size());
+	add_section(FONT_CACHE_CLASS_KERNING, class_kerning.data(), class_kerning.size());
+	add_section(FONT_CACHE_CLASS_DATA, class_data.data(), class_data.size());
+	add_section(FONT_CACHE_NAMES, names.data(), names.size());
+	add_section(FONT_CACHE_STRINGS, strings.data(), strings.size());
 
-	font_data->meta_data.unitsPerEm = head_table.unitsPerEm;
-	font_data->meta_data.Ascender = hhea_table.Ascender;
-	font_data->meta_data.Descender = hhea_table.Descender;
-	font_data->meta_data.LineGap = hhea_table.LineGap;
+	header.blob_size = blob.size();
+	header.checksum = cache_hash(blob.data() + sizeof(FontCacheHeader), blob.size() - sizeof(FontCacheHeader), 0xCBF29CE484222325ull);
+	memcpy(blob.data(), &header, sizeof(FontCacheHeader));
+}
 
+int8_t TTFFontParser::save_font_cache_file(const char* file_name, const FontData& font_data, uint64_t source_key) {
+#ifndef __EMSCRIPTEN__
+	std::vector<char> blob;
+	save_font_cache(font_data, source_key, blob);
+	std::ofstream file_stream(file_name, std::ofstream::binary | std::ofstream::trunc);
+	if (!file_stream || !file_stream.write(blob.data(), std::streamsize(blob.size())))
+		return -1;
 	return 0;
+#else
+	return -1;
+#endif
 }
 
-int16_t TTFFontParser::get_kearning_offset(FontData* font_data, uint32_t left_glyph, uint32_t right_glyph)
-{
-	if (font_data->has_kearning_table) {
-		auto kern_data = font_data->kearning_table.find((uint64_t(left_glyph) << 32) | uint64_t(right_glyph));
-		return (kern_data == font_data->kearning_table.end()) ? 0 : kern_data->second;
+/*
+* Only the header and the section bounds are checked, the contents are trusted like output of this library unless verify_checksum is set
+*/
+int8_t TTFFontParser::FontCache::open(const char* _data, size_t _length, uint64_t source_key, bool verify_checksum) {
+	if (file && file->data != _data)
+		file.reset();
+	data = nullptr;
+	length = 0;
+	header = nullptr;
+	if (!_data || _length < sizeof(FontCacheHeader) || (uintptr_t(_data) % alignof(uint64_t)))
+		return -1;
+	const FontCacheHeader* blob_header = (const FontCacheHeader*)_data;
+	if (memcmp(blob_header->magic, "TTFCACHE", sizeof(blob_header->magic)) || blob_header->version != version || blob_header->byte_order != 0x01020304)
+		return -1;
+	if (source_key && blob_header->source_key != source_key)
+		return -1;
+	if (blob_header->blob_size != _length)
+		return -3;
+	for (uint32_t i = 0; i < FONT_CACHE_NUM_SECTIONS; i++) {
+		const FontCacheSection& blob_section = blob_header->sections[i];
+		if (blob_section.offset % alignof(uint64_t) || blob_section.offset > _length || blob_section.count > (_length - blob_section.offset) / font_cache_element_size[i])
+			return -3;
 	}
-	else
+	//Sizes the lookups rely on
+	const uint64_t num_page_ranges = blob_header->sections[FONT_CACHE_PAGE_RANGES].count;
+	const uint64_t num_first_pairs = blob_header->sections[FONT_CACHE_KERNING_FIRST_PAIR].count;
+	if (blob_header->sections[FONT_CACHE_GLYPHS].count < blob_header->num_glyphs || (num_page_ranges && num_page_ranges != CharacterMap::num_pages + 1) ||
+		blob_header->sections[FONT_CACHE_KERNING_VALUES].count != blob_header->sections[FONT_CACHE_KERNING_RIGHT_GLYPHS].count)
+		return -3;
+	if (num_first_pairs > 0xFFFF + 2 || (num_first_pairs && ((const uint32_t*)(_data + blob_header->sections[FONT_CACHE_KERNING_FIRST_PAIR].offset))[num_first_pairs - 1] > blob_header->sections[FONT_CACHE_KERNING_RIGHT_GLYPHS].count))
+		return -3;
+	const FontCacheClassKerning* class_kerning = (const FontCacheClassKerning*)(_data + blob_header->sections[FONT_CACHE_CLASS_KERNING].offset);
+	const uint64_t class_data_size = blob_header->sections[FONT_CACHE_CLASS_DATA].count;
+	for (uint64_t i = 0; i < blob_header->sections[FONT_CACHE_CLASS_KERNING].count; i++) {
+		const FontCacheClassKerning& subtable = class_kerning[i];
+		if (uint64_t(subtable.first_classes) + subtable.num_first_classes > class_data_size || uint64_t(subtable.second_classes) + subtable.num_second_entries > class_data_size ||
+			uint64_t(subtable.values) + subtable.num_values > class_data_size)
+			return -3;
+	}
+	if (verify_checksum && cache_hash(_data + sizeof(FontCacheHeader), _length - sizeof(FontCacheHeader), 0xCBF29CE484222325ull) != blob_header->checksum)
+		return -3;
+	data = _data;
+	length = _length;
+	header = blob_header;
+	return 0;
+}
+
+int8_t TTFFontParser::FontCache::open_file(const char* file_name, uint64_t source_key, bool verify_checksum) {
+	auto file_buffer = std::make_shared<FontFileBuffer>();
+	if (file_buffer->open(file_name))
+		return -1;
+	int8_t error = open(file_buffer->data, file_buffer->length, source_key, verify_checksum);
+	file = std::move(file_buffer);
+	return error;
+}
+
+uint16_t TTFFontParser::FontCache::get_glyph_index(uint32_t character) const {
+	if (!section_count(FONT_CACHE_PAGE_RANGES))
 		return 0;
+	return CharacterMap::find_glyph_index(section<CharacterMap::CharacterRange>(FONT_CACHE_CHARACTER_RANGES), section_count(FONT_CACHE_CHARACTER_RANGES),
+		section<uint16_t>(FONT_CACHE_GLYPH_IDS), section<uint32_t>(FONT_CACHE_PAGE_RANGES), section_count(FONT_CACHE_CHARACTERS), character);
+}
+
+uint32_t TTFFontParser::FontCache::get_character(uint16_t glyph_index) const {
+	return glyph_index < section_count(FONT_CACHE_CHARACTERS) ? section<uint32_t>(FONT_CACHE_CHARACTERS)[glyph_index] : 0;
+}
+
+const TTFFontParser::FontCacheGlyph* TTFFontParser::FontCache::get_glyph_by_index(uint16_t glyph_index) const {
+	if (glyph_index >= num_glyphs())
+		return nullptr;
+	const FontCacheGlyph* glyph = section<FontCacheGlyph>(FONT_CACHE_GLYPHS) + glyph_index;
+	return glyph->present ? glyph : nullptr;
+}
+
+const TTFFontParser::FontCacheGlyph* TTFFontParser::FontCache::get_glyph(uint32_t character) const {
+	const uint16_t glyph_index = get_glyph_index(character);
+	return glyph_index ? get_glyph_by_index(glyph_index) : nullptr;
+}
+
+int16_t TTFFontParser::FontCache::get_kerning(uint16_t left_glyph, uint16_t right_glyph) const {
+	int16_t value = 0;
+	if (KerningTable::find_pair(section<uint32_t>(FONT_CACHE_KERNING_FIRST_PAIR), section_count(FONT_CACHE_KERNING_FIRST_PAIR), section<uint16_t>(FONT_CACHE_KERNING_RIGHT_GLYPHS),
+		section<int16_t>(FONT_CACHE_KERNING_VALUES), left_glyph, right_glyph, value))
+		return value;
+	const FontCacheClassKerning* class_kerning = section<FontCacheClassKerning>(FONT_CACHE_CLASS_KERNING);
+	const uint16_t* class_data = section<uint16_t>(FONT_CACHE_CLASS_DATA);
+	for (uint32_t i = 0; i < section_count(FONT_CACHE_CLASS_KERNING); i++) {
+		const FontCacheClassKerning& subtable = class_kerning[i];
+		if (KerningTable::ClassKerning::find_kerning(subtable.first_glyph, class_data + subtable.first_classes, subtable.num_first_classes,
+			subtable.second_glyph, class_data + subtable.second_classes, subtable.num_second_entries, subtable.num_second_classes,
+			(const int16_t*)(class_data + subtable.values), left_glyph, right_glyph, value))
+			return value;
+	}
+	return 0;
 }
 #endif